@@ -16,8 +16,11 @@ string BasicMachine::GetUserInput()
 
     char inputBuffer[256];
     if(!suppressPrompt)
-        puts("Ok");
+        OutputLine("Ok");
+    FlushOutput(true);
+    PauseKeyboard();
     gets_s(inputBuffer, 256);
+    ResumeKeyboard();
     return inputBuffer;
 }
 
@@ -58,7 +61,7 @@ pair<BasicMachine::tLineNumber, BasicMachine::tStatement> BasicMachine::ParseCom
     tStatement tokenizedInput;
 
     // Continuation?
-    if(IsNextSymbolDrop(ptr, ':') && lastLineNum > kCommandLine && program.find(lastLineNum) != program.end())
+    if(IsNextSymbolDrop(ptr, ':') && lastLineNum > kCommandLine && (++stats.lineLookups, program.find(lastLineNum) != program.end()))
     {
         IgnoreSpaces(ptr);
         result.first = lastLineNum;
@@ -126,20 +129,236 @@ void BasicMachine::ExecuteAtPC()
         return;
     }
 
-    byte instruction = executionPointer.lineNum > kCommandLine ? executionPointer.cachedStatement->second[executionPointer.offset] : commandLine[executionPointer.offset];
-    byte* parms = executionPointer.lineNum > kCommandLine ? &executionPointer.cachedStatement->second[executionPointer.offset+1] : &commandLine[executionPointer.offset+1];
-    AdvanceExecutionPointer();
+    // The statement is located once, the instruction code is followed by the parameters length, so the execution
+    // pointer can be advanced right here without going through AdvanceExecutionPointer
+    const byte* instruction = (executionPointer.lineNum > kCommandLine ? programImage.data() + programLines[executionPointer.line].start : commandLine.data()) + executionPointer.offset;
+    const byte* parms = instruction + 1;
+    const byte* lengthPtr = parms;
+    executionPointer.offset += DecodeParmsLength(lengthPtr) + 1 + SizeOfParmsLength();
+    ++stats.statements[(int)*instruction];
+
+    const tInstructionInfo& info = instructionInfo[(int)*instruction];
+    if(!executionPointer.skipForNext || info.nextStatement)
+        (this->*info.do_execute)(parms);
+}
+
+void BasicMachine::ExecuteAtPCProfiled()
+{
+    // The counter is found after the statement, which may be PROFILE ON clearing them all
+    pair<tLineNumber, size_t> statement{ executionPointer.lineNum, executionPointer.offset };
+    auto start = chrono::steady_clock::now();
+    ExecuteAtPC();
+    auto elapsed = chrono::steady_clock::now() - start;
+    tProfileCounter& counter = profile[statement];
+    counter.time += elapsed;
+    ++counter.hits;
+}
+
+void BasicMachine::LinkProgram()
+{
+    programImage.clear();
+    programLines.clear();
+    for (const auto& line : program)
+    {
+        programLines.push_back({ line.first, programImage.size(), line.second.size() });
+        programImage.insert(programImage.end(), line.second.begin(), line.second.end());
+    }
+
+    // Now when all lines are known, resolve the line number operands. Statement offsets (e.g., ELSE references
+    // in IF) are relative to the start of the line, so they do not need any fixing.
+    for (const auto& line : programLines)
+    {
+        size_t offset = 0;
+        while (offset < line.size)
+        {
+            byte* instruction = &programImage[line.start + offset];
+            const auto& info = instructionInfo[(int)*instruction];
+            if (info.do_link != nullptr)
+                (this->*info.do_link)(instruction + 1);
+            FuseInstruction(instruction);
+            const byte* lengthPtr = instruction + 1;
+            offset += DecodeParmsLength(lengthPtr) + 1 + SizeOfParmsLength();
+        }
+    }
+
+    // Anything pointing into the previous image is not valid anymore. Editing the program implies RESTORE.
+    stack.clear();
+    loopStack.clear();
+
+    readPointer.lineNum = programLines.empty() ? kCommandLine : programLines[0].lineNum;
+    readPointer.offset = 0;
+    readPointer.line = 0;
+    readPointer.itemOffset = -1;
+    readPointer.limit = 0;
+
+    programLinked = true;
+}
+
+// Returns programLines.size() if there is no such line
+size_t BasicMachine::FindLine(tLineNumber lineNum) const
+{
+    auto it = lower_bound(programLines.begin(), programLines.end(), lineNum, [](const tLinkedLine& l, tLineNumber n) { return l.lineNum < n; });
+    if (it != programLines.end() && it->lineNum == lineNum)
+        return it - programLines.begin();
+    return programLines.size();
+}
+
+// Line number operands in the linked image already contain the line index (or -1 if there was no such line),
+// the command line still has the actual line numbers
+size_t BasicMachine::ResolveLine(tLineNumber operand)
+{
+    if (executionPointer.lineNum > kCommandLine)
+        return operand < 0 ? programLines.size() : (size_t)operand;
+
+    if (!programLinked)
+        LinkProgram();
+    ++stats.lineLookups;
+    return FindLine(operand);
+}
+
+void BasicMachine::JumpToLine(size_t line)
+{
+    executionPointer.line = line;
+    executionPointer.lineNum = programLines[line].lineNum;
+    executionPointer.offset = 0;
+}
+
+void BasicMachine::LinkLineNum(byte*& parms)
+{
+    const byte* lineNumPtr = parms;
+    ++stats.lineLookups;
+    size_t line = FindLine(DecodeLineNum(lineNumPtr));
+    tLineNumber resolved = line < programLines.size() ? (tLineNumber)line : (tLineNumber)-1;
+    *parms++ = (byte)(resolved & 255);
+    *parms++ = (byte)(resolved >> 8);
+}
+
+// The operand is a number or a numeric variable, ending right at the limit. An integer constant the float would not
+// hold exactly is left to the expression, which compares two of them as integers
+bool BasicMachine::IsNumericOperand(const byte* parms, const byte* limit) const
+{
+    if (GetNextTokenType(parms) == TokenType::ttInteger)
+    {
+        int value = DecodeInteger(parms);
+        return parms == limit && (int64_t)(tNumber)value == value;
+    }
+    if (IsNumberToken(GetNextTokenType(parms)))
+    {
+        SkipToken(parms);
+        return parms == limit;
+    }
+    if (GetNextTokenType(parms) == TokenType::ttVariable)
+        return parms + kVariableTokenSize == limit && holds_alternative<tNumber>(vars[DecodeVariable(parms)].value);
+    return false;
+}
+
+tNumber BasicMachine::DecodeNumericOperand(const byte*& parms) const
+{
+    if (IsNumberToken(GetNextTokenType(parms)))
+        return DecodeNumber(parms);
+    return get<tNumber>(vars[DecodeVariable(parms)].value);
+}
 
-    if(!executionPointer.skipForNext || instructionInfo[(int)instruction].nextStatement)
-        instructionInfo[(int)instruction].do_execute(*this, parms);
+// Returns the infix tokens of the expression
+const byte* BasicMachine::DecodeInfix(const byte* parms, int& length)
+{
+    parms += 1 + SizeOfParmsLength();
+    length = DecodeParmsLength(parms);
+    return parms;
+}
+
+void BasicMachine::FuseInstruction(byte* instruction)
+{
+    const tInstructionInfo& info = instructionInfo[(int)*instruction];
+    const byte* parms = instruction + 1 + SizeOfParmsLength();
+    tExecuteFunction fused = nullptr;
+    int length;
+
+    if (info.do_execute == &BasicMachine::ExecuteLet)
+    {
+        if (GetNextTokenType(parms) == TokenType::ttVariable)
+        {
+            // X=X+operand or X=X-operand
+            int index = DecodeVariable(parms);
+            const byte* infix = DecodeInfix(parms, length);
+            const byte* limit = infix + length;
+            if (holds_alternative<tNumber>(vars[index].value) && length > kVariableTokenSize + 2 &&
+                DecodeVariable(infix) == index && GetNextTokenType(infix) == TokenType::ttOp &&
+                !operatorInfo[(int)infix[1]].unary &&
+                (operatorInfo[(int)infix[1]].name[0] == '+' || operatorInfo[(int)infix[1]].name[0] == '-') &&
+                IsNumericOperand(infix + 2, limit))
+                fused = &BasicMachine::ExecuteLetAdd;
+
+            // A$=A$+expression, the addition right after the variable is the last one done
+            const byte* lengthPtr = parms + 1;
+            int expressionLength = DecodeParmsLength(lengthPtr);
+            const byte* postfixLimit = lengthPtr + expressionLength;
+            infix = DecodeInfix(parms, length);
+            if (holds_alternative<string>(vars[index].value) && length > kVariableTokenSize + 2 &&
+                DecodeVariable(infix) == index && GetNextTokenType(infix) == TokenType::ttOp &&
+                !operatorInfo[(int)infix[1]].unary && operatorInfo[(int)infix[1]].name[0] == '+' &&
+                (int)postfixLimit[-1] == kVariableTokenSize)
+                fused = &BasicMachine::ExecuteLetAppend;
+        }
+        else
+        {
+            // A(operand)=expression
+            int index = DecodeArray(parms);
+            const byte* infix = DecodeInfix(parms, length);
+            if (index >= 0 && IsNumericOperand(infix, infix + length))
+                fused = &BasicMachine::ExecuteLetArray;
+        }
+    }
+    else if (info.do_execute == &BasicMachine::ExecuteIf)
+    {
+        // IF operand comparison operand THEN
+        const byte* infix = DecodeInfix(parms + sizeof(executionPointer.offset), length);
+        const byte* limit = infix + length;
+        const byte* op = infix;
+        SkipToken(op);
+        if (op < limit && IsNumericOperand(infix, op) && GetNextTokenType(op) == TokenType::ttOp &&
+            operatorInfo[(int)op[1]].precedence == 3 && // Comparisons
+            IsNumericOperand(op + 2, limit))
+            fused = &BasicMachine::ExecuteIfCompare;
+    }
+    else if (info.do_execute == &BasicMachine::ExecutePrint)
+    {
+        // PRINT "literal" with an optional semicolon
+        const byte* lengthPtr = instruction + 1;
+        if (DecodeParmsLength(lengthPtr) > 0)
+        {
+            const byte* infix = DecodeInfix(parms, length);
+            const byte* limit = infix + length;
+            if (GetNextTokenType(infix) == TokenType::ttString)
+            {
+                SkipToken(infix);
+                if (infix == limit || (infix + 2 == limit && GetNextTokenType(infix) == TokenType::ttOp && operatorInfo[(int)infix[1]].name[0] == ';'))
+                    fused = &BasicMachine::ExecutePrintString;
+            }
+        }
+    }
+    else if (info.do_execute == &BasicMachine::ExecuteGoto)
+    {
+        // GOTO to an existing line
+        if (DecodeLineNum(parms) >= 0)
+            fused = &BasicMachine::ExecuteGotoLine;
+    }
+
+    if (fused != nullptr)
+    {
+        auto i = find_if(instructionInfo.begin(), instructionInfo.end(), [fused](const tInstructionInfo& i) { return i.do_execute == fused; });
+        *instruction = (byte)(i - instructionInfo.begin());
+    }
 }
 
 void BasicMachine::Init()
 {
+    InitOutput();
+
     if (!instructionInfo.empty())
         return;
 
-#define INSTRUCTION(n, p, e, l) instructionInfo.push_back({ n, mem_fn(&BasicMachine::p), mem_fn(&BasicMachine::e), mem_fn(&BasicMachine::l), false, false, false })
+#define INSTRUCTION(n, p, e, l) instructionInfo.push_back({ n, mem_fn(&BasicMachine::p), &BasicMachine::e, mem_fn(&BasicMachine::l), false, false, false })
 #define INSTRUCTION_NOPARMS(n, e) INSTRUCTION(n, ParseNoParms, e, ListNoParms)
 #define INSTRUCTION_INTERNAL(n) INSTRUCTION(n, ParseNotAllowed, ExecuteNop, ListNoParms)
 #define INSTRUCTION_IGNORE(n) instructionInfo.push_back({ n, nullptr, nullptr, nullptr })
@@ -148,8 +367,14 @@ void BasicMachine::Init()
 #define DATA_STATEMENT instructionInfo.back().dataStatement = true;
 #define NEXT_STATEMENT instructionInfo.back().nextStatement = true;
 #define IF_STATEMENT instructionInfo.back().ifStatement = true;
+#define LINK(k) instructionInfo.back().do_link = &BasicMachine::k;
+// Superinstructions are copies of the original instruction that cannot be parsed and have a different executor
+#define SUPERINSTRUCTION(n, e) instructionInfo.push_back(*find_if(instructionInfo.begin(), instructionInfo.end(), [](const tInstructionInfo& i) { return strcmp(i.name, n) == 0; })); \
+    instructionInfo.back().do_parse = mem_fn(&BasicMachine::ParseNotAllowed); \
+    instructionInfo.back().baseExecute = instructionInfo.back().do_execute; \
+    instructionInfo.back().do_execute = &BasicMachine::e;
     INSTRUCTION("", ParseLet, ExecuteLet, ListLet); // This must be the first one in the list
-    INSTRUCTION("", ParseGoto, ExecuteGoto, ListGoto); // and this must be the second one
+    INSTRUCTION("", ParseGoto, ExecuteGoto, ListGoto); LINK(LinkGoto); // and this must be the second one
     INSTRUCTION_IGNORE(":");
     INSTRUCTION_INTERNAL("TO");
     INSTRUCTION_INTERNAL("STEP");
@@ -162,26 +387,36 @@ void BasicMachine::Init()
     INSTRUCTION("ELSE", ParseElse, ExecuteElse, ListNoParms); SUPPRESS_COLON_BEFORE; SUPPRESS_COLON_AFTER;
     INSTRUCTION_NOPARMS("END", ExecuteEnd);
     INSTRUCTION("FOR", ParseFor, ExecuteFor, ListFor);
-    INSTRUCTION("GOTO", ParseGoto, ExecuteGoto, ListGoto);
-    INSTRUCTION("GOSUB", ParseGosub, ExecuteGosub, ListGosub);
+    INSTRUCTION("GOTO", ParseGoto, ExecuteGoto, ListGoto); LINK(LinkGoto);
+    INSTRUCTION("GOSUB", ParseGosub, ExecuteGosub, ListGosub); LINK(LinkGoto);
     INSTRUCTION("IF", ParseIf, ExecuteIf, ListIf); IF_STATEMENT;  SUPPRESS_COLON_AFTER;
     INSTRUCTION("INPUT", ParseInput, ExecuteInput, ListInput);
     INSTRUCTION("LET", ParseLet, ExecuteLet, ListLet);
     INSTRUCTION("LIST", ParseList, ExecuteList, ListList);
     INSTRUCTION("LOAD", ParseLoad, ExecuteLoad, ListLoad);
+    INSTRUCTION("MAT", ParseMat, ExecuteMat, ListMat);
     INSTRUCTION_NOPARMS("NEW", ExecuteNew);
     INSTRUCTION("NEXT", ParseNext, ExecuteNext, ListNext); NEXT_STATEMENT;
-    INSTRUCTION("ON", ParseOn, ExecuteOn, ListOn);
+    INSTRUCTION("ON", ParseOn, ExecuteOn, ListOn); LINK(LinkOn);
     INSTRUCTION("PRINT", ParsePrint, ExecutePrint, ListPrint);
     INSTRUCTION("READ", ParseRead, ExecuteRead, ListRead);
     INSTRUCTION("REM", ParseRem, ExecuteNop, ListRem);
-    INSTRUCTION_NOPARMS("RUN", ExecuteRun);
-    INSTRUCTION("RESTORE", ParseRestore, ExecuteRestore, ListRestore);
+    INSTRUCTION("RUN", ParseRun, ExecuteRun, ListRun);
+    INSTRUCTION("RESTORE", ParseRestore, ExecuteRestore, ListRestore); LINK(LinkRestore);
     INSTRUCTION_NOPARMS("RETURN", ExecuteReturn);
     INSTRUCTION("SAVE", ParseSave, ExecuteSave, ListSave);
     INSTRUCTION_NOPARMS("STOP", ExecuteEnd);
     INSTRUCTION("RANDOMIZE", ParseRandomize, ExecuteRandomize, ListRandomize);
     INSTRUCTION_NOPARMS("DUMPVARS", ExecuteDumpVars);
+    INSTRUCTION("PROFILE", ParseProfile, ExecuteProfile, ListProfile);
+    INSTRUCTION("TRACE", ParseTrace, ExecuteTrace, ListTrace);
+    INSTRUCTION("STATS", ParseStats, ExecuteStats, ListStats);
+    SUPERINSTRUCTION("LET", ExecuteLetAdd);
+    SUPERINSTRUCTION("LET", ExecuteLetArray);
+    SUPERINSTRUCTION("LET", ExecuteLetAppend);
+    SUPERINSTRUCTION("IF", ExecuteIfCompare);
+    SUPERINSTRUCTION("PRINT", ExecutePrintString);
+    SUPERINSTRUCTION("GOTO", ExecuteGotoLine);
 #undef INSTRUCTION
 #undef INSTRUCITON_NOPARMS
 #undef INSTRUCTION_INTERNAL
@@ -190,6 +425,8 @@ void BasicMachine::Init()
 #undef DATA_STATEMENT
 #undef NEXT_STATEMENT
 #undef IF_STATEMENT
+#undef LINK
+#undef SUPERINSTRUCTION
 
 #define FUNCTION(n, e) functionInfo.push_back({n, mem_fn(&BasicMachine::e)})
     FUNCTION("ABS", ComputeABS);
@@ -198,6 +435,7 @@ void BasicMachine::Init()
     FUNCTION("CHR$", ComputeCHR);
     FUNCTION("COS", ComputeCOS);
     FUNCTION("EXP", ComputeEXP);
+    FUNCTION("FRE", ComputeFRE);
     FUNCTION("INT", ComputeINT);
     FUNCTION("LEFT$", ComputeLEFT);
     FUNCTION("LEN", ComputeLEN);
@@ -246,36 +484,74 @@ void BasicMachine::Init()
 #define SYSTEMVAR(n, g, s) systemVarInfo.push_back({n, mem_fn(&BasicMachine::g), mem_fn(&BasicMachine::s)})
     SYSTEMVAR("INKEY$", GetVarInkey, SetProtectedVar);
     SYSTEMVAR("TIME$", GetVarTime, SetProtectedVar);
+    SYSTEMVAR("COMMAND$", GetVarCommand, SetProtectedVar);
 #undef SYSTEMVAR
 
     inErrorCondition = false;
 }
 
-// The main system loop
-void BasicMachine::Run()
+void BasicMachine::ResetMachine()
 {
-    if (instructionInfo.empty())
-    {
-        ErrorCondition("The system is not ready");
-        return;
-    }
-
     srand((int)time(nullptr));
 
     printPos = 0;
     suppressPrompt = false;
+    ResetStats();
+    executeStatement = &BasicMachine::ExecuteAtPC;
+    profile.clear();
 
     executionPointer.lineNum = kCommandLine;
     executionPointer.offset = 0;
-    executionPointer.cachedStatement = program.end();
+    executionPointer.line = 0;
     executionPointer.skipForNext = false;
     commandLine.clear();
 
+    programLinked = false;
+    programLines.clear();
+
     readPointer.lineNum = kCommandLine;
     readPointer.offset = 0;
-    readPointer.cachedStatement = program.end();
+    readPointer.line = 0;
     readPointer.itemOffset = -1;
     readPointer.limit = 0;
+}
+
+// The running program stays in this loop until it stops - by END, an error, or a keyboard break. Any of these resets
+// the line number, so there is nothing else to check per statement.
+void BasicMachine::ExecuteProgram()
+{
+    while (executionPointer.lineNum > kCommandLine)
+    {
+        // A program line may have a few commands, check if we need to proceed to the next line or there is something left still.
+        if (executionPointer.offset >= programLines[executionPointer.line].size)
+        {
+            if (++executionPointer.line < programLines.size())
+            {
+                executionPointer.lineNum = programLines[executionPointer.line].lineNum;
+                executionPointer.offset = 0;
+            }
+            else
+            {
+                // Reaching the actual end of the program should be identical to the END statement
+                ExecuteEnd(nullptr);
+            }
+        }
+        else
+            (this->*executeStatement)();
+    }
+}
+
+// The main system loop
+void BasicMachine::Run()
+{
+    if (instructionInfo.empty())
+    {
+        ErrorCondition("The system is not ready");
+        return;
+    }
+
+    ResetMachine();
+    StartKeyboard();
 
     while (executionPointer.lineNum != kShutdown)
     {
@@ -284,23 +560,7 @@ void BasicMachine::Run()
         // will trigger the system shutdown.
         if (executionPointer.lineNum > kCommandLine)
         {
-            // A program line may have a few commands, check if we need to proceed to the next line or there is something left still.
-            tStatement& statement = executionPointer.cachedStatement->second;
-            if (executionPointer.offset >= statement.size())
-            {
-                if (++executionPointer.cachedStatement != program.end())
-                {
-                    executionPointer.lineNum = executionPointer.cachedStatement->first;
-                    executionPointer.offset = 0;
-                }
-                else
-                {
-                    // Reaching the actual end of the program should be identical to the END statement
-                    ExecuteEnd(nullptr);
-                }
-            }
-            else
-                ExecuteAtPC();
+            ExecuteProgram();
         }
         else
         {
@@ -313,10 +573,10 @@ void BasicMachine::Run()
                 auto input = ParseCommandLine(ptr);
                 if (inErrorCondition)
                 {
-                    puts(inLine.c_str());
+                    OutputLine(inLine.c_str());
                     for (int i = ptr - inLine.c_str(); i > 0; --i)
-                        putchar(' ');
-                    putchar('^'); putchar('\n');
+                        Output(' ');
+                    OutputLine("^");
                     continue;
                 }
 
@@ -329,14 +589,7 @@ void BasicMachine::Run()
                     else
                         program[input.first] = move(input.second);
 
-                    if (readPointer.lineNum == input.first)
-                    {
-                        readPointer.lineNum = kCommandLine;
-                        readPointer.offset = 0;
-                        readPointer.cachedStatement = program.begin();
-                        readPointer.itemOffset = -1;
-                        readPointer.limit = 0;
-                    }
+                    programLinked = false;
                     suppressPrompt = true; // Don't show "Ok" after every line when typing in the program code
                 }
                 else
@@ -359,6 +612,72 @@ void BasicMachine::Run()
             }
         }
     }
+
+    StopTrace();
+    StopSampling();
+    StopKeyboard();
+    StopOutput();
+}
+
+// Executes a command line as if it was typed in, false if it has failed. If it starts the program, the program is
+// left for ExecuteProgram
+bool BasicMachine::ExecuteCommand(const string& command)
+{
+    const char* ptr = command.c_str();
+    commandLine = ParseCommandLine(ptr).second;
+    executionPointer.offset = 0;
+    executionPointer.skipForNext = false;
+    while (!inErrorCondition && executionPointer.lineNum == kCommandLine && executionPointer.offset < commandLine.size())
+        ExecuteAtPC();
+    return !inErrorCondition;
+}
+
+// Runs the program file without the command line. The standard input and output are left to the program, so it can
+// be used in a pipeline. The exit code tells how it went.
+int BasicMachine::RunBatch(const char* fileName, const string& arguments, bool fast)
+{
+    if (instructionInfo.empty())
+    {
+        ErrorCondition("The system is not ready");
+        return kExitLoadError;
+    }
+
+    ResetMachine();
+    commandArguments = arguments;
+
+    if (!ExecuteCommand(string("LOAD \"") + fileName + '"'))
+    {
+        StopOutput();
+        return kExitLoadError;
+    }
+    if (program.empty())
+    {
+        ErrorCondition("Nothing to run");
+        StopOutput();
+        return kExitLoadError;
+    }
+
+    if (ExecuteCommand(fast ? "RUN FAST" : "RUN"))
+        ExecuteProgram();
+
+    StopTrace();
+    StopSampling();
+    StopOutput();
+    return inErrorCondition ? kExitError : kExitOk;
+}
+
+#ifdef BASIC_TRANSPILED
+// The program generated by --emit-cpp runs right away, it exits the way RunBatch does
+int BasicMachine::RunTranspiled()
+{
+    ExecuteTranspiled();
+
+    StopTrace();
+    StopSampling();
+    StopOutput();
+    if (!transpiledLoaded)
+        return kExitLoadError;
+    return inErrorCondition ? kExitError : kExitOk;
 }
 
 int main()
@@ -366,8 +685,54 @@ int main()
     BasicMachine basicMachine;
 
     basicMachine.Init();
+    return basicMachine.RunTranspiled();
+}
+#elif !defined(BASIC_BENCH) // The benchmark has its own main
+int main(int argc, char* argv[])
+{
+    BasicMachine basicMachine;
+
+    basicMachine.Init();
+
+    // basic --emit-cpp program.bas [program.cpp]
+    if (argc >= 3 && strcmp(argv[1], "--emit-cpp") == 0)
+    {
+        string target = argc > 3 ? argv[3] : string(argv[2]).substr(0, string(argv[2]).rfind('.')) + ".cpp";
+        return basicMachine.EmitCpp(argv[2], target.c_str()) ? 0 : 1;
+    }
+
+    // basic [--fast] [--async-output] [--sample=file] [--trace=file] [--string-heap=bytes] program.bas [arguments]
+    bool fast = false;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; ++arg)
+    {
+        if (strcmp(argv[arg], "--fast") == 0)
+            fast = true;
+        else if (strcmp(argv[arg], "--async-output") == 0)
+            basicMachine.SetOutputPolicy(BasicMachine::kFlushInput, true);
+        else if (strncmp(argv[arg], "--sample=", 9) == 0)
+            basicMachine.StartSampling(argv[arg] + 9);
+        else if (strncmp(argv[arg], "--trace=", 8) == 0)
+            basicMachine.StartTrace(argv[arg] + 8);
+        else if (strncmp(argv[arg], "--string-heap=", 14) == 0)
+            basicMachine.SetStringHeap(strtoul(argv[arg] + 14, nullptr, 10));
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", argv[arg]);
+            return BasicMachine::kExitLoadError;
+        }
+    }
+    if (arg < argc)
+    {
+        string arguments;
+        for (int i = arg + 1; i < argc; ++i)
+            arguments += (i > arg + 1 ? " " : "") + string(argv[i]);
+        return basicMachine.RunBatch(argv[arg], arguments, fast);
+    }
+
     basicMachine.Run();
     puts("Bye!");
 
     return 1;
 }
+#endif
@@ -2,18 +2,60 @@
 // BASIC Programming Language interpreter by Vasyl Tsvirkunov
 
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <vector>
 #include <map>
 #include <string>
+#include <string_view>
+#include <cmath>
 #include <functional>
 #include <variant>
+#include <atomic>
+#include <thread>
+#include <chrono>
 
 using namespace std;
 
+// Build policies. The number type, the dialect and the limits are fixed when the machine is compiled, so none of
+// them costs anything at run time. The single precision engine is the default one, BASIC_DOUBLE builds the double
+// precision engine for scientific programs.
+struct tSinglePolicy
+{
+    typedef float tNumber;
+    static constexpr bool ansiFor = false;          // FOR skips the loop when the start is already past the limit
+    static constexpr int defaultArraySize = 10;     // Upper bound of an array used without DIM
+    static constexpr int printDigits = 6;           // Significant digits of PRINT, STR$ and LIST
+    static constexpr bool nativeCode = true;        // RUN FAST compiles hot loops to x86-64 code (single precision)
+
+    // The token format allows no more
+    static constexpr int maxVariables = 65536;
+    static constexpr int maxArrays = 256;
+    static constexpr int maxUserFunctions = 256;
+};
+
+struct tDoublePolicy : tSinglePolicy
+{
+    typedef double tNumber;
+    static constexpr int printDigits = 15;
+    static constexpr bool nativeCode = false;
+};
+
+#ifdef BASIC_DOUBLE
+typedef tDoublePolicy tBasicPolicy;
+#else
+typedef tSinglePolicy tBasicPolicy;
+#endif
+typedef tBasicPolicy::tNumber tNumber;
+
 class BasicMachine
 {
-    // Build configuration (may become runtime options)
-    static const bool bAnsiFor = false;
+    // Micro-benchmarks (bench/MicroBench.cpp) call the internals directly
+    friend class BasicBenchmark;
+
+    static constexpr bool bAnsiFor = tBasicPolicy::ansiFor;
+    static_assert(tBasicPolicy::maxVariables <= 65536 && tBasicPolicy::maxArrays <= 256 && tBasicPolicy::maxUserFunctions <= 256,
+        "variables are indexed by two bytes, arrays and user functions by one");
 
     // Main machine elements
     typedef vector<byte> tStatement;
@@ -21,23 +63,79 @@ class BasicMachine
     static const tLineNumber kCommandLine = -1;
     static const tLineNumber kShutdown = -2;
     typedef map<tLineNumber, tStatement> tProgram; // Remember, map is sorted by key
+
+    // The program is not executed from the map directly. Before running, it is linked: all statements are laid out
+    // one after another in a single image with an array of lines indexing it, and line number operands of jumps are
+    // replaced with indexes in that array, so GOTO and friends need no lookup and moving to the next line is just an
+    // increment. The map remains the editable source of the program (LIST and SAVE use it), any edit drops the link.
+    struct tLinkedLine
+    {
+        tLineNumber lineNum;
+        size_t start;
+        size_t size;
+    };
+
     struct tExecutionPointer
     {
         tLineNumber lineNum;
         size_t offset;
-        tProgram::iterator cachedStatement;
+        size_t line; // Index in programLines, only valid when lineNum is not kCommandLine
         bool skipForNext;
     };
-    typedef vector<tExecutionPointer> tStack;
+    // GOSUB return points. The sampling profiler reads the chain from a signal handler while the vector may be
+    // moving, so the line numbers of the innermost frames are also kept in a fixed ring with an atomic depth
+    struct tStack : vector<tExecutionPointer>
+    {
+        static constexpr size_t kChainSize = 64;
+        tLineNumber chain[kChainSize];
+        atomic<size_t> depth{ 0 };
+
+        void push_back(const tExecutionPointer& frame)
+        {
+            chain[size() % kChainSize] = frame.lineNum;
+            vector::push_back(frame);
+            depth.store(size(), memory_order_release);
+        }
+        void pop_back()
+        {
+            vector::pop_back();
+            depth.store(size(), memory_order_release);
+        }
+        void clear()
+        {
+            vector::clear();
+            depth.store(0, memory_order_release);
+        }
+    };
 
     tExecutionPointer executionPointer;
     tProgram program;
     tStatement commandLine;
     tStack stack;
 
+    tStatement programImage;
+    vector<tLinkedLine> programLines;
+    bool programLinked;
+
+    void LinkProgram();
+    size_t FindLine(tLineNumber lineNum) const;
+    size_t ResolveLine(tLineNumber operand);
+    void JumpToLine(size_t line);
+    void LinkLineNum(byte*& parms);
+
+    // Superinstructions. When the program is linked, a few very common statement shapes (X=X+1, A(I)=expression,
+    // IF A<B THEN line, PRINT "literal", GOTO line) get their instruction code replaced with a fused one with a dedicated
+    // executor that knows exactly where the operands are. The parameters are not changed, so everything else looking
+    // at the image can treat a superinstruction as the original statement. The program map is not affected at all, so
+    // LIST and SAVE show the original text.
+    void FuseInstruction(byte* instruction);
+    bool IsNumericOperand(const byte* parms, const byte* limit) const;
+    tNumber DecodeNumericOperand(const byte*& parms) const;
+    static const byte* DecodeInfix(const byte* parms, int& length);
+
     // Stack for FOR loop. Each element contains the variable index, limit, step, and execution point for the
     // beginning of the loop (the next command after FOR).
-    typedef vector<tuple<unsigned short, float, float, tExecutionPointer>> tLoopStack;
+    typedef vector<tuple<unsigned short, tNumber, tNumber, tExecutionPointer>> tLoopStack;
     tLoopStack loopStack;
 
     // During parsing IF and THEN/ELSE are linked using this stack. Every time IF is parsed, it gets two slots reserved
@@ -55,25 +153,34 @@ class BasicMachine
     // current character.
     int printPos;
 
+    // Execution goes through a plain member function pointer rather than std::function - this is called for every
+    // statement, so the type-erased call is a measurable part of the execution time. Parse and list are not critical.
+    typedef void (BasicMachine::*tExecuteFunction)(const byte*);
+
     struct tInstructionInfo
     {
         const char* name;
         function<bool(BasicMachine&, tStatement&, const char*&)> do_parse;
-        function<void(BasicMachine&, const byte*)> do_execute;
+        tExecuteFunction do_execute;
         function<string(const BasicMachine&, const byte*)> do_list;
         bool suppressColonBefore; // This flag is used to suppress colons around THEN and ELSE
         bool suppressColonAfter;
         bool dataStatement; // To distinguish DATA
         bool nextStatement; // To distinguish NEXT (FOR does scan ahead)
         bool ifStatement;   // To distinguish IF (so skip statement can skip over it
+        void (BasicMachine::*do_link)(byte*); // Only for instructions with line number operands
+        tExecuteFunction baseExecute; // Only for superinstructions, the executor of the original statement
     };
 
     static vector<tInstructionInfo> instructionInfo;
 
     // Both the program and the command line are tokenized at the parsing stage. Most tokens consist of
     // one byte of the token type and one byte of index in the table. ttVariable has two bytes of index
-    // allowing more than 256 variables; string and expression have length encoded as one byte followed
+    // allowing more than 256 variables; string and expression have length encoded as two bytes followed
     // by actual contents. ttNone does not have anything besides the tag itself.
+    // Expression contents are the tokens in the original (infix) order, prefixed with their length, followed
+    // by the postfix form: one byte per element with the offset of the element's token in the infix part.
+    // The infix part is used only for listing, the evaluator just follows the postfix order.
     // Some token type have very limited context - e.g., ttParameter can appear only in one place in DEF
     // statement.
     // Potential optimization here would be to collapse the tag and the index in one byte for some types.
@@ -90,8 +197,11 @@ class BasicMachine
         ttUserFunction,
         ttExpression,
         ttParameter,
-        ttParameterRef
+        ttParameterRef,
+        ttInteger   // number without a fraction or an exponent, kept as a 32-bit integer
     };
+    static bool IsNumberToken(TokenType t) { return t == TokenType::ttNumber || t == TokenType::ttInteger; }
+    static constexpr int kVariableTokenSize = 3; // Type and two bytes of index
 
     // Special pseudo-value types.
     // There is a function TAB that can only be used in a context of PRINT
@@ -115,16 +225,144 @@ class BasicMachine
         explicit tError(const char* m = nullptr) : message(m) {}
     };
 
+    // Strings are immutable and shared, a copy of a value only counts a reference. The characters follow the header
+    // in the same allocation, or, for a slice made by MID$, LEFT$ or RIGHT$, are in another string kept alive by it.
+    // A string with only one reference may still grow in place, when A$=A$+X appends to it. Strings of variables
+    // and arrays may instead be in the string heap (StringHeap.cpp), such a value points to the length word in
+    // front of the characters, with the lowest bit set.
+    struct tStringData
+    {
+        size_t refs;
+        tStringData* owner;
+        const char* text;
+        size_t length;
+        size_t capacity;    // Zero for a slice
+    };
+
     // There are two types of values - numbers and strings. Both can exist in one or two-dimensional arrays.
-    // An improvement would be to handle numbers as integer and floats separately for performance but
-    // in this version only the float type is used.
+    // Numbers are floats (doubles with BASIC_DOUBLE), or 32-bit integers for variables with the % suffix and for the
+    // integer constants. The arithmetic stays in integers while both operands are and the result fits, functions get
+    // floats.
     // Additionally, expressions evaluate to vectors of values (comma or semicolon separates the subexpressions
     // which may be of different types but to keep the distinction between different separators, those themselves
     // produce values, e.g., "1,3" will end up {1,',',3}). For that tSeparator type is used. Finally, there
     // is tTab which is used only to communicate between TAB and PRINT.
     // There is also a special type tError to signify failed expression calculations.
-    typedef variant<float, string, tSeparator, tTab, tError> tValue;
-    typedef vector<tValue> tExpressionValue;
+    // A value is 8 bytes: the type is in the upper 16 bits, the number, the separator, the TAB offset or the
+    // pointer to the string or to the error message in the rest (user space addresses fit in 48 bits). A double takes
+    // all 64 bits, then the other types are NaNs with the type added to 0xFFF8 and a NaN result is made the positive
+    // one, which is not mistaken for a type. The interface is the one of the variant it replaces, index(),
+    // holds_alternative and get (found next to the standard templates, so <variant> stays included). get<string>
+    // gives a view of the shared characters.
+
+    class tValue
+    {
+        static const uint64_t kPayload = (1ull << 48) - 1;
+        static const uint64_t kTagBase = sizeof(tNumber) == 8 ? 0xFFF8 : 0;
+        enum { kNumber, kString, kSeparator, kTab, kError, kInteger };
+
+        union
+        {
+            tNumber number; // The type bits are zero for floats
+            int integer;
+            uint64_t bits;
+        };
+
+        tValue(int type, uint64_t payload) : bits(((kTagBase + type) << 48) | (payload & kPayload)) {}
+        tStringData* Text() const { return (tStringData*)(uintptr_t)(bits & kPayload); }
+        static tStringData* NewString(size_t length, size_t capacity);
+        static void FreeString(tStringData* s);
+
+        static constexpr int Index(const tNumber*) { return kNumber; }
+        static constexpr int Index(const string*) { return kString; }
+        static constexpr int Index(const tSeparator*) { return kSeparator; }
+        static constexpr int Index(const tTab*) { return kTab; }
+        static constexpr int Index(const tError*) { return kError; }
+        static constexpr int Index(const int*) { return kInteger; }
+
+        tNumber& Get(tNumber*) { return number; }
+        const tNumber& Get(tNumber*) const { return number; }
+        int& Get(int*) { return integer; }
+        const int& Get(int*) const { return integer; }
+        string_view Get(string*) const
+        {
+            if (InHeap())
+                return string_view((const char*)(HeapEntry() + 1), *HeapEntry());
+            return string_view(Text()->text, Text()->length);
+        }
+        tSeparator Get(tSeparator*) const { return tSeparator((char)bits); }
+        tTab Get(tTab*) const { return tTab((int)(int32_t)bits); }
+        tError Get(tError*) const { return tError((const char*)(uintptr_t)(bits & kPayload)); }
+
+    public:
+        tValue() : bits(0) {}
+        tValue(tNumber f) : bits(0)
+        {
+            number = f;
+            if (kTagBase != 0 && f != f)
+                bits = 0x7FF8000000000000ull;
+        }
+        tValue(string_view s);
+        tValue(const string& s) : tValue(string_view(s)) {}
+        tValue(const char* s) : tValue(string_view(s)) {}
+        tValue(tSeparator s) : tValue(kSeparator, (unsigned char)s.kind) {}
+        tValue(tTab t) : tValue(kTab, (uint32_t)t.offset) {}
+        tValue(tError e) : tValue(kError, (uintptr_t)e.message) {}
+        tValue(const tValue& v) : bits(v.bits) { if (v.index() == kString && !InHeap()) ++Text()->refs; }
+        tValue(tValue&& v) noexcept : bits(v.Release()) {}
+        ~tValue() { if (index() == kString && !InHeap() && --Text()->refs == 0) FreeString(Text()); }
+
+        tValue& operator=(const tValue& v)
+        {
+            if (this != &v)
+                *this = tValue(v);
+            return *this;
+        }
+        tValue& operator=(tValue&& v) noexcept
+        {
+            if (this != &v)
+            {
+                this->~tValue();
+                bits = v.Release();
+            }
+            return *this;
+        }
+
+        size_t index() const { return (size_t)((bits >> 48) > kTagBase ? (bits >> 48) - kTagBase : (uint64_t)kNumber); }
+
+        // Integers are made explicitly, an int converts to a float value as before
+        static tValue Integer(int i) { tValue v(kInteger, 0); v.integer = i; return v; }
+        bool IsNumeric() const { return index() == kNumber || index() == kInteger; }
+        tNumber Number() const { return index() == kInteger ? (tNumber)integer : number; }
+
+        // Leaves a number zero behind, the string goes with the bits
+        uint64_t Release() { uint64_t b = bits; bits = 0; return b; }
+
+        // The string heap's strings are not counted, they are only valid until the heap is compacted
+        static tValue FromHeap(const uint32_t* entry) { return tValue(kString, (uintptr_t)entry | 1); }
+        bool InHeap() const { return (bits & 1) != 0; }
+        const uint32_t* HeapEntry() const { return (const uint32_t*)(uintptr_t)(bits & kPayload & ~1ull); }
+
+        // Part of a string, shares the characters unless the part is too short to be worth it
+        tValue Slice(size_t from, size_t count) const;
+        static tValue Concat(string_view a, string_view b);
+        void Append(string_view s);
+
+        template <class T> friend bool holds_alternative(const tValue& v) { return v.index() == Index((T*)nullptr); }
+        template <class T> friend decltype(auto) get(tValue& v) { return v.Get((T*)nullptr); }
+        template <class T> friend decltype(auto) get(const tValue& v) { return v.Get((T*)nullptr); }
+    };
+
+    // Expression value vectors count their allocations for the statistics
+    static uint64_t expressionAllocations;
+    template <class T> struct tCountingAllocator : allocator<T>
+    {
+        template <class U> struct rebind { typedef tCountingAllocator<U> other; };
+        tCountingAllocator() = default;
+        template <class U> tCountingAllocator(const tCountingAllocator<U>&) {}
+        T* allocate(size_t n) { ++expressionAllocations; return allocator<T>::allocate(n); }
+    };
+    typedef vector<tValue, tCountingAllocator<tValue>> tExpressionValue;
 
     // Variables, arrays, and user functions - three types of dynamic values associated with the BASIC program.
     // The actual elements are allocated at the parsing stage and only cleared with NEW.
@@ -135,13 +373,19 @@ class BasicMachine
     };
     vector<tVarInfo> vars;
 
+    // The elements are kept by type in contiguous buffers, numbers and integers as they are and strings as values
+    // (a handle to the characters). The strides, elements per step of each index, are set when the array is created.
     struct tArrayInfo
     {
         string name;
         vector<short> dimensions;
-        vector<tValue> value;
+        vector<int> strides;
+        vector<tNumber> numbers;
+        vector<int> integers;
+        vector<tValue> strings;
     };
     vector<tArrayInfo> arrays;
+    tExpressionValue indexStack;    // The array indexes are evaluated here, it keeps its capacity
 
     struct tUserFunctionInfo
     {
@@ -151,12 +395,37 @@ class BasicMachine
     };
     vector<tUserFunctionInfo> userFunctions;
 
+    // String heap
+    vector<uint64_t> stringHeap;
+    size_t stringHeapTop = 0;   // In 8 byte words as well
+    void StoreValue(tValue& target, tValue val)
+    {
+        if (target.index() != val.index() && val.IsNumeric() && !ConvertNumber(target, val))
+            return;
+        if (stringHeap.empty() || !holds_alternative<string>(val))
+            target = move(val);
+        else
+            StoreHeapString(target, val);
+    }
+    void StoreHeapString(tValue& target, const tValue& val);
+    static bool Assignable(const tValue& target, const tValue& val) { return target.IsNumeric() ? val.IsNumeric() : target.index() == val.index(); }
+    bool ConvertNumber(const tValue& target, tValue& val);
+    void AppendValue(tValue& target, const tValue& val);
+    void CompactStringHeap();
+    void MoveStringsOutOfHeap();
+    size_t StringHeapFree() const;
+
     // Support for arrays
+    static int ElementIndex(const tArrayInfo& ai, const tValue* val, size_t count);
     int ExpressionToIndex(byte ar, const tExpressionValue& val);
+    int ArrayIndex(const string& name);
     void ArrayDefaultCreate(byte ar);
     bool ArrayCreate(byte ar, const tExpressionValue& dims);
-    const tValue& ArrayGet(byte ar, const tExpressionValue& index);
+    tValue ArrayGet(byte ar, const tExpressionValue& index);
     bool ArraySet(byte ar, const tExpressionValue& index, const tValue& val);
+    bool ArraySet(byte ar, int i, const tValue& val);
+    static tValue ArrayElement(const tArrayInfo& ai, int i);
+    bool StoreArrayElement(tArrayInfo& ai, int i, tValue val);
 
     // Reset all variabled to a default state
     void ResetVars();
@@ -211,11 +480,40 @@ class BasicMachine
     bool inErrorCondition;
     void ErrorCondition(const char* description);
 
-    // Called before each statement to check for keyboard interrupt. The value may be retrieved on the next
-    // statement by INKEY$. As a bonus, it clears the buffer so INPUT does not get ghost presses
-    char lastKey;
+    // Keyboard layer (Keyboard.cpp). A background thread reads the keys while the program runs: ESC or Ctrl-C sets
+    // the break flag, other keys are queued for INKEY$. Line input pauses it, so INPUT does not get ghost presses
+    static atomic<bool> keyboardBreak;
+    char keyBuffer[64];
+    atomic<unsigned> keyHead{ 0 }, keyTail{ 0 };
+    atomic<int> keyboardState{ 0 };
+    thread keyboardThread;
+    void StartKeyboard();
+    void StopKeyboard();
+    void PauseKeyboard();
+    void ResumeKeyboard();
+    char ReadKey();
+    // Called before each statement to check for keyboard interrupt
     char TestKeyboard();
 
+    // Output layer (Output.cpp). All console output goes through here and is written out in large pieces, according
+    // to the flush policy, directly or by the writer thread
+    int outputFlush;
+    atomic<FILE*> outputFile{ nullptr }; // Read by the writer thread on each pass
+    string outputBuffer;
+    vector<char> outputRing;
+    atomic<size_t> outputHead{ 0 }, outputTail{ 0 };
+    atomic<bool> outputStop{ false };
+    thread outputThread;
+    void InitOutput();
+    void StopOutput();
+    void FlushOutput(bool wait = false);
+    void Output(const char* text, size_t length);
+    void Output(const char* text);
+    void Output(const string& text);
+    void Output(char c);
+    void OutputLine(const char* text = "");
+    void OutputFormat(const char* format, ...);
+
     static void IgnoreSpaces(const char*& ptr);
     
     // Short unsigned number, used for line numbers and array dimensions. 0 to 32767.
@@ -229,12 +527,14 @@ class BasicMachine
     static bool TryParseWord(tStatement& s, const char*& ptr); // Special case to handle unquoted string alternative in some commands
     static void DecodeString(string& s, const byte*& parms);
     static void DecodeStringQuoted(string& s, const byte*& parms);
-    // Generic number, float packed in four bytes
+    // Generic number, tNumber packed in four or eight bytes
     static bool TryParseNumber(tStatement& s, const char*& ptr);
     static void DecodeNumber(string& s, const byte*& parms);
-    static float DecodeNumber(const byte*& parms);
+    static tNumber DecodeNumber(const byte*& parms);
+    static int DecodeInteger(const byte*& parms);
     // Symbol, a string valid for a variable name
     TokenType TryParseSymbol(tStatement& s, const char*& ptr, const tUserFunctionInfo* context = nullptr);
+    bool TryParseArrayName(tStatement& s, const char*& ptr);
     bool TryParseParameter(tStatement& s, const char*& ptr, tUserFunctionInfo& context);
     void DecodeVariable(string& s, const byte*& parms) const;
     int DecodeVariable(const byte*& parms) const;
@@ -269,6 +569,8 @@ class BasicMachine
     static bool TestMatch(const char* ptr, const char* pattern);
     TokenType TryParseNextToken(tStatement& s, const char*& ptr, const tUserFunctionInfo* context = nullptr);
     static bool TryParseOperation(tStatement& s, const char*& ptr);
+    static void SkipToken(const byte*& parms);
+    static bool EncodePostfix(tStatement& s, size_t infix);
     void DecodeToken(string& s, const byte*& parms, const tUserFunctionInfo* context = nullptr) const; // This should not be called outside of expression
     static void DecodeOperation(string& s, const byte*& parms);
     static int DecodeOperation(const byte*& parms);
@@ -282,29 +584,243 @@ class BasicMachine
     static tValue EvaluateString(const byte*& parms);
     tValue EvaluateVariable(const byte*& parms, const byte* limit);
     tValue EvaluateArray(const byte*& parms, const byte* limit, const tUserFunctionInfo* context = nullptr);
+    int EvaluateArrayIndex(byte ar, const byte*& parms, const tUserFunctionInfo* context = nullptr);
     tValue EvaluateSysVar(const byte*& parms, const byte* limit);
     tValue EvaluateFunction(const byte*& parms, const byte* limit, const tUserFunctionInfo* context = nullptr);
     tValue EvaluateUserFunction(const byte*& parms, const byte* limit, const tUserFunctionInfo* parentContext = nullptr);
     tValue EvaluateParameterRef(const byte*& parms, const byte* limit, const tUserFunctionInfo* context = nullptr);
     tValue EvaluateSubexpression(const byte*& parms, const tUserFunctionInfo* context = nullptr);
     tExpressionValue EvaluateExpression(const byte*& parms, const tUserFunctionInfo* context = nullptr);
+    bool EvaluatePostfix(const byte* infix, const byte* infixLimit, const byte* postfix, const byte* limit, tExpressionValue& result,
+        const tUserFunctionInfo* context);
 
     // User input
     bool suppressPrompt;
     string GetUserInput();
     pair<tLineNumber, tStatement> ParseCommandLine(const char*& ptr);
 
-    // Go to the next statement within the same line
-    void AdvanceExecutionPointer();
+    // Size of the statement being executed, either a program line or the command line
+    size_t CurrentStatementSize() const;
 
     // Execute current statement
     void ExecuteAtPC();
+    // The program loop calls this one, PROFILE ON switches it to the version that measures every statement, so there
+    // is no cost when the profiler is off. RUN FAST is not profiled.
+    void (BasicMachine::*executeStatement)();
+    void ExecuteAtPCProfiled();
+    struct tProfileCounter
+    {
+        uint64_t hits;
+        chrono::steady_clock::duration time;
+    };
+    map<pair<tLineNumber, size_t>, tProfileCounter> profile; // By line number and statement offset
+
+    // Sampling profiler (Sampler.cpp), PROFILE SAMPLE "file"
+    static BasicMachine* sampledMachine;
+    vector<tLineNumber> samples;
+    size_t sampleEnd;
+    size_t samplesDropped;
+    string sampleFile;
+    atomic<bool> samplingStop{ false };
+    thread samplingThread;
+    static void SampleHandler(int);
+    void TakeSample();
+
+    // Tracer (Tracer.cpp), TRACE "file". GOSUB, FOR and INPUT record their begin and end
+    enum { kTraceGosub = 1, kTraceFor, kTraceInput, kTraceReset };
+    struct tTraceEvent
+    {
+        uint64_t time;      // Nanoseconds since the start
+        uint8_t kind;
+        bool begin;
+        tLineNumber lineNum;
+        uint16_t operand;   // GOSUB target line, FOR variable
+    };
+    bool tracing = false;
+    string traceFile;
+    FILE* traceLog = nullptr;
+    vector<tTraceEvent> traceEvents;
+    chrono::steady_clock::time_point traceStart;
+    void TraceEvent(int kind, bool begin, int operand);
+    void TraceReset();
+    // Execute the program until it stops
+    void ExecuteProgram();
+    // Execute a command line that is not typed in (batch mode)
+    bool ExecuteCommand(const string& command);
+    // Arguments of the batch mode, available to the program as COMMAND$
+    string commandArguments;
+
+    // Initial state of the machine, before the command loop or a transpiled program
+    void ResetMachine();
+
+    // Fast execution (RUN FAST). The linked program is compiled into a register based bytecode with typed instructions,
+    // so the value types are checked once by the compiler rather than by every operator. Numbers and strings have separate
+    // register files, each laid out as constants (at negative indexes), variables (same index as in vars), and temporaries.
+    // Arrays are accessed in place. Statements that do not affect the control flow and are not worth compiling (PRINT,
+    // INPUT, READ, DIM...) are handed to the interpreter, the variables are copied out of and back into the registers
+    // around them. If the compiler meets anything it does not support, RUN FAST just falls back to the interpreter.
+    enum class FastOp : unsigned short
+    {
+        NMove, SMove,
+        NAdd, NSubtract, NMultiply, NDivide, NPower, NNegate, NNot, NAnd, NOr,
+        NLess, NLessOrEqual, NGreater, NGreaterOrEqual, NEqual, NNotEqual,
+        SConcat, SCompare, // SCompare has the numeric comparison code in d
+        NFunction,         // d is the index in fastFunctions
+        SLen, SAsc, SVal, SChr, SStr, SLeft, SRight, SMid, SMidCount, SSysVar,
+        NArrayLoad1, NArrayLoad2, NArrayStore1, NArrayStore2,
+        SArrayLoad1, SArrayLoad2, SArrayStore1, SArrayStore2,
+        Jump, JumpIfZero, JumpIfNotLess, JumpIfNotLessOrEqual, JumpIfNotGreater, JumpIfNotGreaterOrEqual, JumpIfNotEqual, JumpIfEqual,
+        Gosub, Return, On, For, Next,
+        EvalCondition, EvalNumber, Interpret, Error, End
+    };
+
+    // Typically a is the destination (or the jump target) and b, c are the operands. Array instructions have the array
+    // index in d, MID$ with count keeps the count register there.
+    struct tFastInstruction
+    {
+        FastOp code;
+        int a;
+        int b;
+        int c;
+        int d;
+    };
+
+    struct tFastOperand
+    {
+        int reg;
+        bool isString;
+        bool isInteger = false; // An integer constant, operations on two of them are folded exactly
+        int integer = 0;
+    };
+
+    // Native code generator for RUN FAST (x86-64 only, elsewhere the loops simply stay in the bytecode). The back edges
+    // are counted, and once a loop gets hot the bytecode between its head and the back edge is translated to machine code.
+    // The most used numeric registers are kept in XMM registers for the whole loop. Anything the generator does not
+    // handle becomes an exit back to the bytecode at that instruction.
+    struct tJitArray
+    {
+        byte* data;
+        int length; // Only for one dimensional arrays, 0 otherwise
+        int rows;   // Only for two dimensional arrays, 0 otherwise
+        int columns;
+    };
+
+    struct tJitContext
+    {
+        tNumber* numbers;
+        tJitArray* arrays;
+        tNumber limit; // Current FOR loop
+        tNumber step;
+        int budget;  // Back edges left before returning to the bytecode, so the keyboard is still checked
+        int loopDone;
+    };
+
+    typedef int (*tJitFunction)(tJitContext*); // Returns the bytecode instruction to continue from
+
+    struct tJitLoop
+    {
+        tJitFunction entry;
+        int var; // Loop variable for NEXT, -1 for jumps
+        unsigned count;
+    };
+
+    // FOR loop as the bytecode sees it, the body is the first instruction after FOR
+    struct tFastLoop
+    {
+        int var;
+        tNumber limit;
+        tNumber step;
+        size_t body;
+    };
+
+    struct tFastProgram
+    {
+        vector<tFastInstruction> code;
+        vector<size_t> lines; // Program line of each instruction, for error messages
+        vector<int> jumpTables; // Targets for ON
+        map<size_t, vector<int>> handOffs; // Variables of the statements and expressions given to the interpreter, by instruction
+        vector<const char*> messages;
+        vector<tNumber> numbers;
+        vector<string> strings;
+        int numberConstants;
+        int stringConstants;
+
+        // Compiler state
+        vector<tNumber> numberValues;
+        vector<string> stringValues;
+        int numberTop;
+        int stringTop;
+        int numberRegisters;
+        int stringRegisters;
+        size_t line;
+        size_t lastValue; // The last instruction producing a value, so its destination may be changed to a variable
+        vector<pair<size_t, size_t>> lineJumps; // Instruction and line index, resolved when all lines are compiled
+        vector<pair<size_t, size_t>> statementJumps; // Instruction and offset in the line, resolved at the end of the line
+        vector<pair<size_t, size_t>> statementStarts; // Offset in the line and the first instruction of the statement
+
+        // Native code for the hot loops, indexed by the back edge instruction (the NEXT or the jump closing the loop)
+        vector<tJitLoop> jitLoops;
+    };
+    tFastProgram fastProgram;
+
+    bool CompileFast();
+    bool CompileFastStatement(size_t offset);
+    bool CompileFastLet(const byte* parms);
+    int CompileFastNumber(const byte*& parms, int target, const char* message);
+    bool CompileFastExpression(const byte*& parms, vector<tFastOperand>& values);
+    bool CompileFastValue(const byte*& parms, tFastOperand& value);
+    bool CompileFastFunction(int function, const vector<tFastOperand>& args, tFastOperand& result);
+    void EmitFast(FastOp code, int a, int b = 0, int c = 0, int d = 0);
+    void EmitFastValue(FastOp code, int a, int b = 0, int c = 0, int d = 0);
+    void EmitFastMove(const tFastOperand& value, int target);
+    void EmitFastError(const char* message);
+    int FastNumberConstant(tNumber value);
+    tFastOperand FastIntegerConstant(int64_t value);
+    int FastStringConstant(const string& value);
+    int FastTemporary(bool isString);
+    void FastRelease(const tFastOperand& value);
+    bool IsFastTemporary(const tFastOperand& value) const;
+    void EmitFastInterpret(size_t offset, size_t next);
+    void ListFastHandOff(const byte* parms, const byte* limit);
+    bool CollectFastVariables(const byte* parms, const byte* limit, vector<int>& variables) const;
+    const vector<int>* FastHandOff(size_t pc) const;
+    bool FastStoreString(size_t pc, tValue& target, const string& value);
+    void FastSyncOut(const vector<int>* variables = nullptr);
+    void FastSyncIn(const vector<int>* variables = nullptr);
+    void ExecuteFast();
+
+    typedef tNumber (*tFastFunction)(tNumber);
+    static tFastFunction FastFunction(int index);
+
+    vector<tJitArray> jitArrays;
+    vector<pair<void*, size_t>> jitMemory;
+
+    size_t ExecuteJit(size_t backEdge, size_t head, int var, tNumber limit, tNumber step, bool& loopDone);
+    tJitFunction CompileJit(size_t backEdge, size_t head, int var);
+    void JitRelease();
+
+    // Ahead of time compilation (--emit-cpp). The program is compiled to the bytecode the same way as for RUN FAST and
+    // each instruction is written out as C++, jumps become gotos and returns go through a switch over the return points.
+    // The generated file defines ExecuteTranspiled and is built with BASIC_TRANSPILED together with the interpreter
+    // sources, which serve as its runtime. The program text is embedded in the generated file and compiled again at
+    // startup, so the registers, DATA, and the statements handed to the interpreter are all where the code expects them.
+    bool LoadTranspiled(const char* const* source, size_t codeSize);
+    bool transpiledLoaded = false;
+    bool TranspiledInterpret(size_t pc);
+    bool TranspiledNext(size_t pc, vector<tFastLoop>& loops, size_t& body);
+    int TranspiledElement(size_t pc, int ar, tNumber i);
+    int TranspiledElement(size_t pc, int ar, tNumber i, tNumber j);
+    void TranspiledError(size_t pc, const char* message);
+    bool TranspiledBreak();
+    string TranspiledOperand(int reg, bool isString) const;
 
     // Instructions. Each instruction needs three functions to be implemented: to parse, to execute, and to list. Parse and
     // list must be consistent enought that output of list passed to parse produces the original data. Parse should validate
     // as much of the syntax as possible. List can make an assumption that the data is correct; Execute can assume the general
     // correctness of data layout but it needs to deal with runtime problem. Also, expressions are not evaluated during parsing
     // so they may fail to parse during execution (this may change in the future).
+    // Instructions taking line numbers also have a link function that resolves them in the linked program image. When running
+    // from the program, Execute gets the resolved index; when running from the command line, it gets the line number.
     void ExecuteBye(const byte* parms);
 
     void ExecuteCls(const byte* parms);
@@ -333,6 +849,7 @@ class BasicMachine
     bool ParseGoto(tStatement& result, const char*& ptr);
     void ExecuteGoto(const byte* parms);
     string ListGoto(const byte* parms) const;
+    void LinkGoto(byte* parms);
 
     bool ParseGosub(tStatement& result, const char*& ptr);
     void ExecuteGosub(const byte* parms);
@@ -367,9 +884,11 @@ class BasicMachine
     bool ParseOn(tStatement& result, const char*& ptr);
     void ExecuteOn(const byte* parms);
     string ListOn(const byte* parms) const;
+    void LinkOn(byte* parms);
 
     bool ParsePrint(tStatement& result, const char*& ptr);
     void ExecutePrint(const byte* parms);
+    void PrintValues(const tExpressionValue& val);
     string ListPrint(const byte* parms) const;
 
     bool ParseRandomize(tStatement& result, const char*& ptr);
@@ -383,11 +902,15 @@ class BasicMachine
     bool ParseRem(tStatement& result, const char*& ptr);
     string ListRem(const byte* parms) const;
 
+    bool ParseRun(tStatement& result, const char*& ptr);
     void ExecuteRun(const byte* parms);
+    void StartProgram();
+    string ListRun(const byte* parms) const;
 
     bool ParseRestore(tStatement& result, const char*& ptr);
     void ExecuteRestore(const byte* parms);
     string ListRestore(const byte* parms) const;
+    void LinkRestore(byte* parms);
 
     void ExecuteReturn(const byte* parms);
     
@@ -406,6 +929,40 @@ class BasicMachine
 
     // Extensions
     void ExecuteDumpVars(const byte* parms);
+    bool ParseTrace(tStatement& result, const char*& ptr);
+    void ExecuteTrace(const byte* parms);
+    string ListTrace(const byte* parms) const;
+    bool ParseStats(tStatement& result, const char*& ptr);
+    void ExecuteStats(const byte* parms);
+    string ListStats(const byte* parms) const;
+    bool ParseProfile(tStatement& result, const char*& ptr);
+    void ExecuteProfile(const byte* parms);
+    string ListProfile(const byte* parms) const;
+
+    // MAT statements (Matrix.cpp). The first byte of the parameters is the form of the statement
+    enum class MatForm : unsigned char { Read, Print, Zer, Con, Idn, Copy, Add, Subtract, Multiply, Transpose, Inverse, Scale };
+    struct tMatrix
+    {
+        tNumber* data;  // Element (1,1)
+        int rows, columns;
+        int stride;     // From a row to the next one
+        bool isVector;
+    };
+    bool ParseMat(tStatement& result, const char*& ptr);
+    void ExecuteMat(const byte* parms);
+    string ListMat(const byte* parms) const;
+    bool MatrixOf(int ar, tMatrix& m);
+    void StoreMatrix(int ar, int rows, int columns, const vector<tNumber>& values);
+    void MatRead(const byte* parms, const byte* limit);
+    void MatPrint(const byte* parms, const byte* limit);
+
+    // Superinstructions
+    void ExecuteLetAdd(const byte* parms);
+    void ExecuteLetArray(const byte* parms);
+    void ExecuteLetAppend(const byte* parms);
+    void ExecuteIfCompare(const byte* parms);
+    void ExecutePrintString(const byte* parms);
+    void ExecuteGotoLine(const byte* parms);
 
     // Functions
     tValue ComputeABS(const tExpressionValue& arg) const;
@@ -414,6 +971,7 @@ class BasicMachine
     tValue ComputeCHR(const tExpressionValue& arg) const;
     tValue ComputeCOS(const tExpressionValue& arg) const;
     tValue ComputeEXP(const tExpressionValue& arg) const;
+    tValue ComputeFRE(const tExpressionValue& arg) const;
     tValue ComputeINT(const tExpressionValue& arg) const;
     tValue ComputeLEFT(const tExpressionValue& arg) const;
     tValue ComputeLEN(const tExpressionValue& arg) const;
@@ -452,17 +1010,78 @@ class BasicMachine
     // Operator helpers
     pair<int, bool> ComputeCompare(tExpressionValue& val) const;
     bool PrepareLogical(tExpressionValue& val, bool& a, bool& b) const;
-    bool PrepareMath(tExpressionValue& val, float& a, float& b) const;
+    bool PrepareMath(tExpressionValue& val, tNumber& a, tNumber& b) const;
+    bool PrepareInteger(tExpressionValue& val, int64_t& a, int64_t& b) const;
+    static tValue IntegerResult(int64_t value);
     void ComputeOperator(tExpressionValue& val, int code) const;
 
     // System variables
     const tValue& GetVarInkey();
     const tValue& GetVarTime();
+    const tValue& GetVarCommand();
     bool SetProtectedVar(const tValue& val);
 
 public:
+    ~BasicMachine() { StopTrace(); StopSampling(); StopKeyboard(); StopOutput(); }
+
     void Init();
 
+    // Output flush policy. The buffer is always written out when it is full and before the system exits
+    enum
+    {
+        kFlushLine = 1,     // After each line
+        kFlushInput = 2     // Before INPUT and INKEY$, so the prompt is visible
+    };
+    void SetOutputPolicy(int flush, bool async);
+    void SetOutputFile(FILE* file);
+
+    // Stops the running program before the next statement, safe to call from a signal handler
+    static void RequestBreak();
+
     // The main system loop
     void Run();
+
+    // Runs a program file without the command line (basic program.bas [arguments])
+    enum
+    {
+        kExitOk = 0,
+        kExitError = 1,         // The program has stopped with an error
+        kExitLoadError = 2      // The file cannot be loaded
+    };
+    int RunBatch(const char* fileName, const string& arguments, bool fast);
+
+    // Keeps the strings of variables and arrays in a heap of the given size, as Microsoft BASIC did, zero for the
+    // usual allocation
+    void SetStringHeap(size_t bytes);
+
+    // Sampling profiler, the folded stacks are written to the file when it stops
+    void StartSampling(const char* fileName);
+    bool StopSampling();
+
+    // Tracer, the Chrome trace events are written to the file when it stops
+    void StartTrace(const char* fileName);
+    bool StopTrace();
+
+    // Interpreter statistics since the last reset (Stats.cpp), also shown by STATS. RUN FAST only counts the heap.
+    struct tStats
+    {
+        uint64_t statements[256];   // Executed statements by the instruction code
+        uint64_t expressions;       // EvaluateExpression calls
+        uint64_t expressionVectors; // Allocations by expression value vectors
+        uint64_t stringCopies;      // String values copied out of variables, arrays and parameters
+        uint64_t lineLookups;       // Searches for a line number
+        uint64_t heapAllocations;   // operator new calls, in the whole process (only with BASIC_HEAP_STATS)
+        uint64_t heapBytes;
+    };
+    tStats GetStats() const;
+    void ResetStats();
+    uint64_t StatementCount() const;
+
+    // Writes the program as C++ source (see LoadTranspiled), and the entry point of the generated code
+    bool EmitCpp(const char* sourceName, const char* targetName);
+    void ExecuteTranspiled();
+    int RunTranspiled(); // With the exit codes of RunBatch
+
+private:
+    tStats stats;
 };
@@ -0,0 +1,1259 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "Basic.h"
+
+#include <chrono>
+#include <thread>
+
+// Compiler and virtual machine for RUN FAST. The compiler walks the linked program statement by statement, expressions
+// are compiled from their postfix form so the operand stack maps directly to the temporary registers.
+
+static tNumber FastRND(tNumber x)
+{
+    return ((tNumber)rand()) / RAND_MAX;
+}
+
+static tNumber FastSGN(tNumber x)
+{
+    return x < 0 ? (tNumber)-1 : (tNumber)1;
+}
+
+// Picks the overload of a math function for the number type
+typedef tNumber (*tMathFunction)(tNumber);
+static constexpr tMathFunction Math(tMathFunction f) { return f; }
+
+// Numeric functions of one numeric argument, NFunction keeps the index in this table
+static const struct
+{
+    const char* name;
+    tNumber (*compute)(tNumber);
+} fastFunctions[] =
+{
+    { "ABS", Math(fabs) },
+    { "ATN", Math(atan) },
+    { "COS", Math(cos) },
+    { "EXP", Math(exp) },
+    { "INT", Math(floor) },
+    { "LOG", Math(log) },
+    { "RND", FastRND },
+    { "SGN", FastSGN },
+    { "SIN", Math(sin) },
+    { "SQR", Math(sqrt) },
+    { "TAN", Math(tan) }
+};
+
+BasicMachine::tFastFunction BasicMachine::FastFunction(int index)
+{
+    return fastFunctions[index].compute;
+}
+
+void BasicMachine::EmitFast(FastOp code, int a, int b, int c, int d)
+{
+    fastProgram.code.push_back({ code, a, b, c, d });
+    fastProgram.lines.push_back(fastProgram.line);
+}
+
+void BasicMachine::EmitFastValue(FastOp code, int a, int b, int c, int d)
+{
+    EmitFast(code, a, b, c, d);
+    fastProgram.lastValue = fastProgram.code.size() - 1;
+}
+
+// If the value was just calculated into a temporary, the instruction can store it to the target directly
+void BasicMachine::EmitFastMove(const tFastOperand& value, int target)
+{
+    if (value.reg == target)
+        return;
+
+    auto& code = fastProgram.code;
+    if (IsFastTemporary(value) && fastProgram.lastValue == code.size() - 1 && code.back().a == value.reg)
+        code.back().a = target;
+    else
+        EmitFast(value.isString ? FastOp::SMove : FastOp::NMove, target, value.reg);
+}
+
+void BasicMachine::EmitFastError(const char* message)
+{
+    fastProgram.messages.push_back(message);
+    EmitFast(FastOp::Error, 0, 0, 0, (int)fastProgram.messages.size() - 1);
+}
+
+int BasicMachine::FastNumberConstant(tNumber value)
+{
+    auto& values = fastProgram.numberValues;
+    size_t index = find(values.begin(), values.end(), value) - values.begin();
+    if (index == values.size())
+        values.push_back(value);
+    return -(int)index - 1;
+}
+
+// An integer result as IntegerResult makes it, one out of the 32-bit range is a float from then on
+BasicMachine::tFastOperand BasicMachine::FastIntegerConstant(int64_t value)
+{
+    if (value >= INT32_MIN && value <= INT32_MAX)
+        return { FastNumberConstant((tNumber)value), false, true, (int)value };
+    return { FastNumberConstant((tNumber)value), false };
+}
+
+int BasicMachine::FastStringConstant(const string& value)
+{
+    auto& values = fastProgram.stringValues;
+    size_t index = find(values.begin(), values.end(), value) - values.begin();
+    if (index == values.size())
+        values.push_back(value);
+    return -(int)index - 1;
+}
+
+// Temporaries are allocated and released in the stack order, the same way the values are evaluated
+int BasicMachine::FastTemporary(bool isString)
+{
+    tFastProgram& fp = fastProgram;
+    if (isString)
+    {
+        fp.stringRegisters = max(fp.stringRegisters, fp.stringTop + 1);
+        return fp.stringTop++;
+    }
+    else
+    {
+        fp.numberRegisters = max(fp.numberRegisters, fp.numberTop + 1);
+        return fp.numberTop++;
+    }
+}
+
+void BasicMachine::FastRelease(const tFastOperand& value)
+{
+    if (IsFastTemporary(value))
+    {
+        if (value.isString)
+            fastProgram.stringTop = value.reg;
+        else
+            fastProgram.numberTop = value.reg;
+    }
+}
+
+bool BasicMachine::IsFastTemporary(const tFastOperand& value) const
+{
+    return value.reg >= (int)vars.size();
+}
+
+bool BasicMachine::CompileFastValue(const byte*& parms, tFastOperand& value)
+{
+    vector<tFastOperand> values;
+    if (!CompileFastExpression(parms, values) || values.size() != 1)
+        return false;
+    value = values[0];
+    return true;
+}
+
+// Compiles a list of comma separated values. Anything that is not supported (user functions, TAB, semicolons, or
+// operations on mismatched types that would fail anyway) makes it return false, leaving the instructions emitted so far.
+bool BasicMachine::CompileFastExpression(const byte*& parms, vector<tFastOperand>& values)
+{
+    static const struct
+    {
+        const char* name;
+        FastOp code;
+    } binaryOps[] =
+    {
+        { "+", FastOp::NAdd },
+        { "-", FastOp::NSubtract },
+        { "*", FastOp::NMultiply },
+        { "/", FastOp::NDivide },
+        { "^", FastOp::NPower },
+        { "<", FastOp::NLess },
+        { "<=", FastOp::NLessOrEqual },
+        { ">", FastOp::NGreater },
+        { ">=", FastOp::NGreaterOrEqual },
+        { "=", FastOp::NEqual },
+        { "<>", FastOp::NNotEqual },
+        { "AND", FastOp::NAnd },
+        { "OR", FastOp::NOr }
+    };
+
+    if (GetNextTokenType(parms) != TokenType::ttExpression)
+        return false;
+
+    ++parms;
+    int length = DecodeParmsLength(parms);
+    const byte* limit = parms + length;
+    int infixLength = DecodeParmsLength(parms);
+    const byte* infix = parms;
+    const byte* infixLimit = infix + infixLength;
+    parms = limit;
+
+    vector<tFastOperand> stack;
+    size_t separators = 0;
+
+    for (const byte* postfix = infixLimit; postfix < limit; ++postfix)
+    {
+        const byte* token = infix + (int)*postfix;
+        switch (GetNextTokenType(token))
+        {
+        case TokenType::ttNumber:
+            stack.push_back({ FastNumberConstant(DecodeNumber(token)), false });
+            break;
+
+        case TokenType::ttInteger:
+            stack.push_back(FastIntegerConstant(DecodeInteger(token)));
+            break;
+
+        case TokenType::ttString:
+        {
+            string value;
+            DecodeString(value, token);
+            stack.push_back({ FastStringConstant(value), true });
+            break;
+        }
+
+        case TokenType::ttVariable:
+        {
+            int index = DecodeVariable(token);
+            stack.push_back({ index, holds_alternative<string>(vars[index].value) });
+            break;
+        }
+
+        case TokenType::ttExpression:
+        {
+            tFastOperand value;
+            if (!CompileFastValue(token, value))
+                return false;
+            stack.push_back(value);
+            break;
+        }
+
+        case TokenType::ttArray:
+        {
+            int ar = DecodeArray(token);
+            vector<tFastOperand> index;
+            if (token >= infixLimit || !CompileFastExpression(token, index) || index.empty() || index.size() > 2)
+                return false;
+            for (auto i = index.rbegin(); i != index.rend(); ++i)
+            {
+                if (i->isString)
+                    return false;
+                FastRelease(*i);
+            }
+
+            bool isString = arrays[ar].name.back() == '$';
+            int reg = FastTemporary(isString);
+            if (index.size() == 1)
+                EmitFastValue(isString ? FastOp::SArrayLoad1 : FastOp::NArrayLoad1, reg, index[0].reg, 0, ar);
+            else
+                EmitFastValue(isString ? FastOp::SArrayLoad2 : FastOp::NArrayLoad2, reg, index[0].reg, index[1].reg, ar);
+            stack.push_back({ reg, isString });
+            break;
+        }
+
+        case TokenType::ttFunction:
+        {
+            int function = DecodeFunction(token);
+            vector<tFastOperand> args;
+            tFastOperand result;
+            if (token >= infixLimit || !CompileFastExpression(token, args) || !CompileFastFunction(function, args, result))
+                return false;
+            stack.push_back(result);
+            break;
+        }
+
+        case TokenType::ttSystemVar:
+        {
+            int index = DecodeSysVar(token);
+            if (string(systemVarInfo[index].name).back() != '$')
+                return false;
+            int reg = FastTemporary(true);
+            EmitFastValue(FastOp::SSysVar, reg, 0, 0, index);
+            stack.push_back({ reg, true });
+            break;
+        }
+
+        case TokenType::ttOp:
+        {
+            const tOperatorInfo& info = operatorInfo[DecodeOperation(token)];
+            string name = info.name;
+            if (info.separator)
+            {
+                if (name != "," || stack.size() != separators + 1)
+                    return false;
+                ++separators;
+            }
+            else if (info.unary)
+            {
+                if (stack.size() <= separators)
+                    return false;
+                tFastOperand a = stack.back();
+                if (name == "+")
+                    break;
+                if (a.isString)
+                    return false;
+                stack.pop_back();
+
+                // Negative constants are common enough to be folded right here
+                if (name == "-" && a.isInteger)
+                {
+                    stack.push_back(FastIntegerConstant(-(int64_t)a.integer));
+                    break;
+                }
+                if (name == "-" && a.reg < 0)
+                {
+                    stack.push_back({ FastNumberConstant(-fastProgram.numberValues[-a.reg - 1]), false });
+                    break;
+                }
+
+                FastRelease(a);
+                int reg = FastTemporary(false);
+                EmitFastValue(name == "-" ? FastOp::NNegate : FastOp::NNot, reg, a.reg);
+                stack.push_back({ reg, false });
+            }
+            else
+            {
+                if (stack.size() < separators + 2)
+                    return false;
+                tFastOperand b = stack.back();
+                stack.pop_back();
+                tFastOperand a = stack.back();
+                stack.pop_back();
+                if (a.isString != b.isString)
+                    return false;
+
+                // The interpreter computes with two integers exactly, the float registers would round above 2^24
+                if (a.isInteger && b.isInteger && (name == "+" || name == "-" || name == "*" || info.precedence == 3))
+                {
+                    int64_t i = a.integer, j = b.integer;
+                    if (info.precedence == 3)
+                    {
+                        bool cond = name == "<" ? i < j : name == "<=" ? i <= j : name == ">" ? i > j :
+                            name == ">=" ? i >= j : name == "=" ? i == j : i != j;
+                        stack.push_back({ FastNumberConstant((tNumber)cond), false });
+                    }
+                    else
+                        stack.push_back(FastIntegerConstant(name == "+" ? i + j : name == "-" ? i - j : i * j));
+                    break;
+                }
+
+                const auto* op = find_if(begin(binaryOps), end(binaryOps), [&name](const auto& o) { return name == o.name; });
+                if (op == end(binaryOps))
+                    return false;
+
+                FastOp code = op->code;
+                int d = 0;
+                bool isString = false;
+                if (a.isString)
+                {
+                    if (code == FastOp::NAdd)
+                    {
+                        code = FastOp::SConcat;
+                        isString = true;
+                    }
+                    else if (code >= FastOp::NLess && code <= FastOp::NNotEqual)
+                    {
+                        d = (int)code - (int)FastOp::NLess;
+                        code = FastOp::SCompare;
+                    }
+                    else
+                        return false;
+                }
+
+                FastRelease(b);
+                FastRelease(a);
+                int reg = FastTemporary(isString);
+                EmitFastValue(code, reg, a.reg, b.reg, d);
+                stack.push_back({ reg, isString });
+            }
+            break;
+        }
+
+        default:
+            return false;
+        }
+    }
+
+    if (stack.size() != separators + 1)
+        return false;
+
+    values = move(stack);
+    return true;
+}
+
+bool BasicMachine::CompileFastFunction(int function, const vector<tFastOperand>& args, tFastOperand& result)
+{
+    string name = functionInfo[function].name;
+
+    // Check the argument types, a string for 'S' and a number for 'N'
+    auto signature = [&args](const char* types)
+    {
+        if (args.size() != strlen(types))
+            return false;
+        for (size_t i = 0; i < args.size(); ++i)
+            if (args[i].isString != (types[i] == 'S'))
+                return false;
+        return true;
+    };
+
+    FastOp code;
+    bool isString = true;
+    int index = 0;
+
+    auto fn = find_if(begin(fastFunctions), end(fastFunctions), [&name](const auto& f) { return name == f.name; });
+    if (fn != end(fastFunctions) && signature("N"))
+    {
+        code = FastOp::NFunction;
+        index = (int)(fn - begin(fastFunctions));
+        isString = false;
+    }
+    else if (name == "LEN" && signature("S"))
+    {
+        code = FastOp::SLen;
+        isString = false;
+    }
+    else if (name == "ASC" && signature("S"))
+    {
+        code = FastOp::SAsc;
+        isString = false;
+    }
+    else if (name == "VAL" && signature("S"))
+    {
+        code = FastOp::SVal;
+        isString = false;
+    }
+    else if (name == "CHR$" && signature("N"))
+        code = FastOp::SChr;
+    else if (name == "STR$" && signature("N"))
+        code = FastOp::SStr;
+    else if (name == "LEFT$" && signature("SN"))
+        code = FastOp::SLeft;
+    else if (name == "RIGHT$" && signature("SN"))
+        code = FastOp::SRight;
+    else if (name == "MID$" && signature("SN"))
+        code = FastOp::SMid;
+    else if (name == "MID$" && signature("SNN"))
+        code = FastOp::SMidCount;
+    else
+        return false;
+
+    for (auto i = args.rbegin(); i != args.rend(); ++i)
+        FastRelease(*i);
+
+    result = { FastTemporary(isString), isString };
+    if (code == FastOp::NFunction)
+        EmitFastValue(code, result.reg, args[0].reg, 0, index);
+    else
+        EmitFastValue(code, result.reg, args[0].reg, args.size() > 1 ? args[1].reg : 0, args.size() > 2 ? args[2].reg : 0);
+    return true;
+}
+
+// Compiles a numeric expression to the target register (or anywhere if target is negative) and returns the register with
+// the result. If the expression cannot be compiled, the interpreter evaluates it at runtime, reporting the message if the
+// result is not a number.
+int BasicMachine::CompileFastNumber(const byte*& parms, int target, const char* message)
+{
+    tFastProgram& fp = fastProgram;
+    const byte* start = parms;
+    size_t size = fp.code.size();
+    int numberTop = fp.numberTop;
+    int stringTop = fp.stringTop;
+
+    vector<tFastOperand> values;
+    if (CompileFastExpression(parms, values) && values.size() == 1 && !values[0].isString)
+    {
+        if (target < 0)
+            return values[0].reg;
+        EmitFastMove(values[0], target);
+        return target;
+    }
+
+    fp.code.resize(size);
+    fp.lines.resize(size);
+    fp.numberTop = numberTop;
+    fp.stringTop = stringTop;
+    parms = start;
+    SkipToken(parms);
+
+    if (target < 0)
+        target = FastTemporary(false);
+    fp.messages.push_back(message);
+    ListFastHandOff(start, parms);
+    EmitFastValue(FastOp::EvalNumber, target, (int)(start - programImage.data()), 0, (int)fp.messages.size() - 1);
+    return target;
+}
+
+bool BasicMachine::CompileFastLet(const byte* parms)
+{
+    (void)DecodeParmsLength(parms);
+
+    tFastOperand value;
+    if (GetNextTokenType(parms) == TokenType::ttArray)
+    {
+        int ar = DecodeArray(parms);
+        bool isString = arrays[ar].name.back() == '$';
+        vector<tFastOperand> index;
+        if (!CompileFastExpression(parms, index) || index.empty() || index.size() > 2)
+            return false;
+        for (const auto& i : index)
+            if (i.isString)
+                return false;
+        if (!CompileFastValue(parms, value) || value.isString != isString)
+            return false;
+
+        if (index.size() == 1)
+            EmitFast(isString ? FastOp::SArrayStore1 : FastOp::NArrayStore1, value.reg, index[0].reg, 0, ar);
+        else
+            EmitFast(isString ? FastOp::SArrayStore2 : FastOp::NArrayStore2, value.reg, index[0].reg, index[1].reg, ar);
+    }
+    else
+    {
+        int index = DecodeVariable(parms);
+
+        // With the string heap the interpreter stores the string variables, so the heap fills up (and reports being
+        // out of space) on the same statement as under RUN
+        if (!stringHeap.empty() && holds_alternative<string>(vars[index].value))
+            return false;
+        if (!CompileFastValue(parms, value) || value.isString != holds_alternative<string>(vars[index].value))
+            return false;
+        EmitFastMove(value, index);
+    }
+    return true;
+}
+
+// The statement is left to the interpreter. The usual ones list their variables, so the hand-off only syncs those
+void BasicMachine::EmitFastInterpret(size_t offset, size_t next)
+{
+    tFastProgram& fp = fastProgram;
+    const tLinkedLine& line = programLines[fp.line];
+    const byte* instruction = programImage.data() + line.start + offset;
+    const byte* parms = instruction + 1;
+    int length = DecodeParmsLength(parms);
+    const byte* limit = parms + length;
+    const tInstructionInfo& info = instructionInfo[(int)*instruction];
+    tExecuteFunction execute = info.baseExecute != nullptr ? info.baseExecute : info.do_execute;
+
+    if (execute == &BasicMachine::ExecuteInput && GetNextTokenType(parms) == TokenType::ttString)
+    {
+        SkipToken(parms);
+        ++parms; // Comma or semicolon after the prompt
+    }
+
+    if (execute == &BasicMachine::ExecuteLet || execute == &BasicMachine::ExecutePrint || execute == &BasicMachine::ExecuteInput ||
+        execute == &BasicMachine::ExecuteRead || execute == &BasicMachine::ExecuteRandomize)
+        ListFastHandOff(parms, limit);
+    else
+        fp.handOffs.erase(fp.code.size());
+    EmitFast(FastOp::Interpret, (int)(line.start + offset), (int)fp.line, (int)next);
+}
+
+// The variables the next instruction hands to the interpreter, all of them when the tokens do not tell
+void BasicMachine::ListFastHandOff(const byte* parms, const byte* limit)
+{
+    tFastProgram& fp = fastProgram;
+    vector<int> variables;
+    if (!CollectFastVariables(parms, limit, variables))
+    {
+        fp.handOffs.erase(fp.code.size());
+        return;
+    }
+    sort(variables.begin(), variables.end());
+    variables.erase(unique(variables.begin(), variables.end()), variables.end());
+    fp.handOffs[fp.code.size()] = move(variables);
+}
+
+// False if the tokens may reach other variables, a user function through its body and FRE through the string heap
+bool BasicMachine::CollectFastVariables(const byte* parms, const byte* limit, vector<int>& variables) const
+{
+    while (parms < limit)
+    {
+        switch (GetNextTokenType(parms))
+        {
+        case TokenType::ttVariable:
+            variables.push_back(DecodeVariable(parms));
+            break;
+
+        case TokenType::ttExpression:
+        {
+            ++parms;
+            int length = DecodeParmsLength(parms);
+            const byte* next = parms + length;
+            int infixLength = DecodeParmsLength(parms);
+            if (!CollectFastVariables(parms, parms + infixLength, variables))
+                return false;
+            parms = next;
+            break;
+        }
+
+        case TokenType::ttUserFunction:
+            return false;
+
+        case TokenType::ttFunction:
+            if (strcmp(functionInfo[DecodeFunction(parms)].name, "FRE") == 0)
+                return false;
+            break;
+
+        default:
+            SkipToken(parms);
+            break;
+        }
+    }
+    return true;
+}
+
+const vector<int>* BasicMachine::FastHandOff(size_t pc) const
+{
+    auto found = fastProgram.handOffs.find(pc);
+    return found != fastProgram.handOffs.end() ? &found->second : nullptr;
+}
+
+bool BasicMachine::CompileFastStatement(size_t offset)
+{
+    tFastProgram& fp = fastProgram;
+    const tLinkedLine& line = programLines[fp.line];
+    const byte* instruction = programImage.data() + line.start + offset;
+    const byte* parms = instruction + 1;
+    const byte* lengthPtr = parms;
+    size_t next = offset + DecodeParmsLength(lengthPtr) + 1 + SizeOfParmsLength();
+    const tInstructionInfo& info = instructionInfo[(int)*instruction];
+    tExecuteFunction execute = info.baseExecute != nullptr ? info.baseExecute : info.do_execute; // Superinstructions compile as their originals
+
+    fp.numberTop = (int)vars.size();
+    fp.stringTop = (int)vars.size();
+    fp.lastValue = SIZE_MAX;
+
+    if (execute == &BasicMachine::ExecuteLet)
+    {
+        // Assignments the compiler does not handle are left to the interpreter
+        size_t size = fp.code.size();
+        if (!CompileFastLet(parms))
+        {
+            fp.code.resize(size);
+            fp.lines.resize(size);
+            EmitFastInterpret(offset, next);
+        }
+    }
+    else if (execute == &BasicMachine::ExecuteGoto || execute == &BasicMachine::ExecuteGosub)
+    {
+        bool gosub = execute == &BasicMachine::ExecuteGosub;
+        (void)DecodeParmsLength(parms);
+        tLineNumber target = DecodeLineNum(parms);
+        if (target < 0)
+            EmitFastError(gosub ? "GOSUB - line not found" : "GOTO - line not found");
+        else
+        {
+            fp.lineJumps.push_back({ fp.code.size(), (size_t)target });
+            EmitFast(gosub ? FastOp::Gosub : FastOp::Jump, 0);
+        }
+    }
+    else if (execute == &BasicMachine::ExecuteReturn)
+        EmitFast(FastOp::Return, 0);
+    else if (execute == &BasicMachine::ExecuteOn)
+    {
+        int length = DecodeParmsLength(parms);
+        const byte* limit = parms + length;
+        int reg = CompileFastNumber(parms, -1, "Bad expression in ON");
+        int gosub = *parms++ == (byte)1 ? 1 : 0;
+        int table = (int)fp.jumpTables.size();
+        while (parms < limit)
+            fp.jumpTables.push_back(DecodeLineNum(parms)); // Line index for now, -1 if not found
+        EmitFast(FastOp::On, reg, table, (int)fp.jumpTables.size() - table, gosub);
+    }
+    else if (execute == &BasicMachine::ExecuteIf)
+    {
+        (void)DecodeParmsLength(parms);
+        size_t offsetElse = *(size_t*)parms;
+        parms += sizeof(executionPointer.offset);
+
+        const byte* start = parms;
+        size_t size = fp.code.size();
+        vector<tFastOperand> values;
+        if (CompileFastExpression(parms, values) && values.size() == 1 && !values[0].isString)
+        {
+            // A comparison right before the jump is fused with it
+            static const FastOp inverse[] = { FastOp::JumpIfNotLess, FastOp::JumpIfNotLessOrEqual, FastOp::JumpIfNotGreater,
+                FastOp::JumpIfNotGreaterOrEqual, FastOp::JumpIfNotEqual, FastOp::JumpIfEqual };
+            if (IsFastTemporary(values[0]) && fp.lastValue == fp.code.size() - 1 && fp.code.back().a == values[0].reg &&
+                fp.code.back().code >= FastOp::NLess && fp.code.back().code <= FastOp::NNotEqual)
+                fp.code.back().code = inverse[(int)fp.code.back().code - (int)FastOp::NLess];
+            else
+                EmitFast(FastOp::JumpIfZero, 0, values[0].reg);
+        }
+        else
+        {
+            fp.code.resize(size);
+            fp.lines.resize(size);
+            parms = start;
+            SkipToken(parms);
+            int reg = FastTemporary(false);
+            ListFastHandOff(start, parms);
+            EmitFastValue(FastOp::EvalCondition, reg, (int)(start - programImage.data()));
+            EmitFast(FastOp::JumpIfZero, 0, reg);
+        }
+        fp.statementJumps.push_back({ fp.code.size() - 1, offsetElse ? offsetElse : SIZE_MAX });
+    }
+    else if (execute == &BasicMachine::ExecuteElse)
+    {
+        // Same logic as in ExecuteElse, the THEN clause is done, skip the ELSE clause
+        if (next < line.size)
+        {
+            const byte* following = programImage.data() + line.start + next;
+            const byte* followingParms = following + 1;
+            size_t target;
+            if (instructionInfo[(int)*following].ifStatement)
+            {
+                (void)DecodeParmsLength(followingParms);
+                size_t offsetElse = *(size_t*)followingParms;
+                target = offsetElse == 0 ? SIZE_MAX : offsetElse - 1 - SizeOfParmsLength();
+            }
+            else
+                target = next + DecodeParmsLength(followingParms) + 1 + SizeOfParmsLength();
+
+            fp.statementJumps.push_back({ fp.code.size(), target });
+            EmitFast(FastOp::Jump, 0);
+        }
+    }
+    else if (execute == &BasicMachine::ExecuteFor)
+    {
+        (void)DecodeParmsLength(parms);
+        int index = DecodeVariable(parms);
+        if (holds_alternative<string>(vars[index].value))
+            return false;
+
+        CompileFastNumber(parms, index, "Malformed FOR loop");
+        int limit = CompileFastNumber(parms, -1, "Malformed FOR loop");
+        int step = GetNextTokenType(parms) == TokenType::ttNone ? FastNumberConstant(1.0) : CompileFastNumber(parms, -1, "Malformed FOR loop");
+        EmitFast(FastOp::For, index, limit, step);
+    }
+    else if (execute == &BasicMachine::ExecuteNext)
+    {
+        int length = DecodeParmsLength(parms);
+        const byte* limit = parms + length;
+        int start = (int)fp.code.size();
+        if (length == 0)
+            EmitFast(FastOp::Next, -1, start);
+        while (parms < limit)
+        {
+            int index = DecodeVariable(parms);
+            if (holds_alternative<string>(vars[index].value))
+                return false;
+            EmitFast(FastOp::Next, index, start);
+        }
+    }
+    else if (execute == &BasicMachine::ExecuteEnd)
+        EmitFast(FastOp::End, 0);
+    else if (execute == &BasicMachine::ExecuteNop || execute == &BasicMachine::ExecuteData)
+        ; // Nothing to do
+    else if (execute == &BasicMachine::ExecutePrint || execute == &BasicMachine::ExecuteInput || execute == &BasicMachine::ExecuteRead ||
+        execute == &BasicMachine::ExecuteRestore || execute == &BasicMachine::ExecuteDim || execute == &BasicMachine::ExecuteDef ||
+        execute == &BasicMachine::ExecuteRandomize || execute == &BasicMachine::ExecuteCls || execute == &BasicMachine::ExecuteDumpVars ||
+        execute == &BasicMachine::ExecuteList || execute == &BasicMachine::ExecuteSave || execute == &BasicMachine::ExecuteMat)
+        EmitFastInterpret(offset, next);
+    else
+        return false; // RUN, NEW, LOAD, BYE are not supported in a compiled program
+
+    return true;
+}
+
+bool BasicMachine::CompileFast()
+{
+    // ANSI style FOR has to scan for the matching NEXT, the compiler does not do that
+    if (bAnsiFor || programLines.empty())
+        return false;
+
+    // The number registers have no integers, the integer variables are left to the interpreter
+    for (const auto& v : vars)
+        if (holds_alternative<int>(v.value))
+            return false;
+    for (const auto& a : arrays)
+        if (a.name.back() == '%')
+            return false;
+
+    tFastProgram& fp = fastProgram;
+    JitRelease();
+    fp.jitLoops.clear();
+    fp.code.clear();
+    fp.lines.clear();
+    fp.jumpTables.clear();
+    fp.handOffs.clear();
+    fp.messages.clear();
+    fp.numberValues.clear();
+    fp.stringValues.clear();
+    fp.lineJumps.clear();
+    fp.numberRegisters = (int)vars.size();
+    fp.stringRegisters = (int)vars.size();
+
+    vector<size_t> lineStarts;
+    for (fp.line = 0; fp.line < programLines.size(); ++fp.line)
+    {
+        lineStarts.push_back(fp.code.size());
+        fp.statementJumps.clear();
+        fp.statementStarts.clear();
+
+        size_t offset = 0;
+        while (offset < programLines[fp.line].size)
+        {
+            fp.statementStarts.push_back({ offset, fp.code.size() });
+            if (!CompileFastStatement(offset))
+                return false;
+            const byte* lengthPtr = programImage.data() + programLines[fp.line].start + offset + 1;
+            offset += DecodeParmsLength(lengthPtr) + 1 + SizeOfParmsLength();
+        }
+
+        // Jumps within the line, anything past the last statement goes to the next line
+        for (const auto& jump : fp.statementJumps)
+        {
+            size_t target = fp.code.size();
+            for (const auto& start : fp.statementStarts)
+                if (start.first == jump.second)
+                    target = start.second;
+            fp.code[jump.first].a = (int)target;
+        }
+    }
+
+    // Reaching the end of the program is the same as END
+    lineStarts.push_back(fp.code.size());
+    fp.line = programLines.size() - 1;
+    EmitFast(FastOp::End, 0);
+
+    for (const auto& jump : fp.lineJumps)
+        fp.code[jump.first].a = (int)lineStarts[jump.second];
+    for (auto& target : fp.jumpTables)
+        if (target >= 0)
+            target = (int)lineStarts[target];
+
+    fp.jitLoops.assign(fp.code.size(), { nullptr, -1, 0 });
+
+    // The constants are placed in front of the variables in the reverse order, so constant n is at register -n-1
+    fp.numberConstants = (int)fp.numberValues.size();
+    fp.numbers.assign(fp.numberConstants + fp.numberRegisters, 0.0f);
+    copy(fp.numberValues.rbegin(), fp.numberValues.rend(), fp.numbers.begin());
+
+    fp.stringConstants = (int)fp.stringValues.size();
+    fp.strings.assign(fp.stringConstants + fp.stringRegisters, string());
+    copy(fp.stringValues.rbegin(), fp.stringValues.rend(), fp.strings.begin());
+
+    return true;
+}
+
+// A string stored into the string heap may run out of space, the error then goes to the line of the instruction. False
+// if the program has stopped
+bool BasicMachine::FastStoreString(size_t pc, tValue& target, const string& value)
+{
+    if (!stringHeap.empty())
+    {
+        executionPointer.line = fastProgram.lines[pc];
+        executionPointer.lineNum = programLines[executionPointer.line].lineNum;
+    }
+    StoreValue(target, value);
+    if (!inErrorCondition)
+        return true;
+    FastSyncOut();
+    return false;
+}
+
+// Variables are copied from the registers before the interpreter gets control, and back after that. Only the listed
+// ones when there is a list (see FastHandOff), all of them otherwise. A string the variable already holds is not
+// stored again, which would only fill the string heap with copies
+void BasicMachine::FastSyncOut(const vector<int>* variables)
+{
+    const tNumber* numbers = fastProgram.numbers.data() + fastProgram.numberConstants;
+    const string* strings = fastProgram.strings.data() + fastProgram.stringConstants;
+    auto sync = [&](size_t i)
+    {
+        if (holds_alternative<tNumber>(vars[i].value))
+            get<tNumber>(vars[i].value) = numbers[i];
+        else if (get<string>(vars[i].value) != strings[i])
+            StoreValue(vars[i].value, strings[i]);
+    };
+    if (variables != nullptr)
+        for (int i : *variables)
+            sync(i);
+    else
+        for (size_t i = 0; i < vars.size(); ++i)
+            sync(i);
+}
+
+void BasicMachine::FastSyncIn(const vector<int>* variables)
+{
+    tNumber* numbers = fastProgram.numbers.data() + fastProgram.numberConstants;
+    string* strings = fastProgram.strings.data() + fastProgram.stringConstants;
+    auto sync = [&](size_t i)
+    {
+        if (holds_alternative<tNumber>(vars[i].value))
+            numbers[i] = get<tNumber>(vars[i].value);
+        else
+            strings[i] = get<string>(vars[i].value);
+    };
+    if (variables != nullptr)
+        for (int i : *variables)
+            sync(i);
+    else
+        for (size_t i = 0; i < vars.size(); ++i)
+            sync(i);
+}
+
+void BasicMachine::ExecuteFast()
+{
+    const tFastInstruction* code = fastProgram.code.data();
+    tNumber* N = fastProgram.numbers.data() + fastProgram.numberConstants;
+    string* S = fastProgram.strings.data() + fastProgram.stringConstants;
+
+    vector<tFastLoop> loops;
+    vector<size_t> returns;
+    size_t pc = 0;
+
+    auto setLine = [this](size_t line)
+    {
+        executionPointer.line = line;
+        executionPointer.lineNum = programLines[line].lineNum;
+    };
+
+    // Errors are reported on the line of the current instruction
+    auto fail = [&](const char* message)
+    {
+        setLine(fastProgram.lines[pc - 1]);
+        FastSyncOut();
+        ErrorCondition(message);
+    };
+
+    // The keyboard is checked on jumps only, any loop has at least one
+    auto interrupted = [this]()
+    {
+        if (TestKeyboard() != 27)
+            return false;
+        FastSyncOut();
+        ExecuteEnd(nullptr);
+        return true;
+    };
+
+    auto index1 = [this](int ar, tNumber i)
+    {
+        const auto& dimensions = arrays[ar].dimensions;
+        int n = (int)i;
+        return dimensions.size() == 1 && n >= 0 && n < dimensions[0] ? n : -1;
+    };
+
+    auto index2 = [this](int ar, tNumber i, tNumber j)
+    {
+        const auto& dimensions = arrays[ar].dimensions;
+        int n = (int)i;
+        int m = (int)j;
+        return dimensions.size() == 2 && n >= 0 && n < dimensions[0] && m >= 0 && m < dimensions[1] ? n * arrays[ar].strides[0] + m : -1;
+    };
+
+    FastSyncIn();
+
+    for (;;)
+    {
+        const tFastInstruction& i = code[pc++];
+        switch (i.code)
+        {
+        case FastOp::NMove: N[i.a] = N[i.b]; break;
+        case FastOp::SMove: S[i.a] = S[i.b]; break;
+        case FastOp::NAdd: N[i.a] = N[i.b] + N[i.c]; break;
+        case FastOp::NSubtract: N[i.a] = N[i.b] - N[i.c]; break;
+        case FastOp::NMultiply: N[i.a] = N[i.b] * N[i.c]; break;
+        case FastOp::NDivide:
+            if (N[i.c] == 0.0f)
+            {
+                fail("Division by zero");
+                return;
+            }
+            N[i.a] = N[i.b] / N[i.c];
+            break;
+        case FastOp::NPower: N[i.a] = pow(N[i.b], N[i.c]); break;
+        case FastOp::NNegate: N[i.a] = -N[i.b]; break;
+        case FastOp::NNot: N[i.a] = (tNumber)(N[i.b] == 0.0f); break;
+        case FastOp::NAnd: N[i.a] = (tNumber)(N[i.b] != 0.0f && N[i.c] != 0.0f); break;
+        case FastOp::NOr: N[i.a] = (tNumber)(N[i.b] != 0.0f || N[i.c] != 0.0f); break;
+        case FastOp::NLess: N[i.a] = (tNumber)(N[i.b] < N[i.c]); break;
+        case FastOp::NLessOrEqual: N[i.a] = (tNumber)(N[i.b] <= N[i.c]); break;
+        case FastOp::NGreater: N[i.a] = (tNumber)(N[i.b] > N[i.c]); break;
+        case FastOp::NGreaterOrEqual: N[i.a] = (tNumber)(N[i.b] >= N[i.c]); break;
+        case FastOp::NEqual: N[i.a] = (tNumber)(N[i.b] == N[i.c]); break;
+        case FastOp::NNotEqual: N[i.a] = (tNumber)(N[i.b] != N[i.c]); break;
+
+        case FastOp::SConcat:
+            if (i.a == i.b && i.a != i.c)
+                S[i.a] += S[i.c];
+            else
+                S[i.a] = S[i.b] + S[i.c];
+            break;
+
+        case FastOp::SCompare:
+        {
+            int r = S[i.b].compare(S[i.c]);
+            bool result = false;
+            switch (i.d)
+            {
+            case 0: result = r < 0; break;
+            case 1: result = r <= 0; break;
+            case 2: result = r > 0; break;
+            case 3: result = r >= 0; break;
+            case 4: result = r == 0; break;
+            case 5: result = r != 0; break;
+            }
+            N[i.a] = (tNumber)result;
+            break;
+        }
+
+        case FastOp::NFunction: N[i.a] = fastFunctions[i.d].compute(N[i.b]); break;
+        case FastOp::SLen: N[i.a] = (tNumber)S[i.b].length(); break;
+        case FastOp::SAsc: N[i.a] = (tNumber)S[i.b][0]; break;
+        case FastOp::SVal: N[i.a] = (tNumber)atof(S[i.b].c_str()); break;
+        case FastOp::SChr: S[i.a] = string{ (char)N[i.b] }; break;
+
+        case FastOp::SStr:
+        {
+            char buf[30];
+            sprintf(buf, "%.*g", tBasicPolicy::printDigits, N[i.b]);
+            S[i.a] = buf;
+            break;
+        }
+
+        case FastOp::SLeft:
+        {
+            int len = S[i.b].length();
+            S[i.a] = S[i.b].substr(0, min((int)N[i.c], len));
+            break;
+        }
+
+        case FastOp::SRight:
+        {
+            int len = S[i.b].length();
+            S[i.a] = S[i.b].substr(max(0, len - (int)N[i.c]), string::npos);
+            break;
+        }
+
+        case FastOp::SMid:
+        case FastOp::SMidCount:
+        {
+            int len = S[i.b].length();
+            int from = min(len, (int)N[i.c]) - 1;
+            if (from < 0)
+            {
+                fail("Bad expression");
+                return;
+            }
+            int count = len - from;
+            if (i.code == FastOp::SMidCount)
+                count = min(len - from, (int)N[i.d]);
+            S[i.a] = S[i.b].substr(from, count);
+            break;
+        }
+
+        case FastOp::SSysVar:
+        {
+            const tValue& value = systemVarInfo[i.d].do_eval(*this);
+            S[i.a] = holds_alternative<string>(value) ? get<string>(value) : string();
+            break;
+        }
+
+        case FastOp::NArrayLoad1:
+        case FastOp::NArrayLoad2:
+        case FastOp::SArrayLoad1:
+        case FastOp::SArrayLoad2:
+        case FastOp::NArrayStore1:
+        case FastOp::NArrayStore2:
+        case FastOp::SArrayStore1:
+        case FastOp::SArrayStore2:
+        {
+            bool two = i.code == FastOp::NArrayLoad2 || i.code == FastOp::SArrayLoad2 || i.code == FastOp::NArrayStore2 || i.code == FastOp::SArrayStore2;
+            int index = two ? index2(i.d, N[i.b], N[i.c]) : index1(i.d, N[i.b]);
+            if (index < 0)
+            {
+                fail("Bad array index");
+                return;
+            }
+            tArrayInfo& ar = arrays[i.d];
+            switch (i.code)
+            {
+            case FastOp::NArrayLoad1: case FastOp::NArrayLoad2: N[i.a] = ar.numbers[index]; break;
+            case FastOp::SArrayLoad1: case FastOp::SArrayLoad2: S[i.a] = get<string>(ar.strings[index]); break;
+            case FastOp::NArrayStore1: case FastOp::NArrayStore2: ar.numbers[index] = N[i.a]; break;
+            default:
+                if (!FastStoreString(pc - 1, ar.strings[index], S[i.a]))
+                    return;
+                break;
+            }
+            break;
+        }
+
+        case FastOp::Jump:
+        {
+            size_t from = pc - 1;
+            pc = i.a;
+            if (interrupted())
+                return;
+            if (pc <= from)
+            {
+                bool loopDone;
+                pc = ExecuteJit(from, pc, -1, 0.0f, 0.0f, loopDone);
+            }
+            break;
+        }
+
+        case FastOp::JumpIfZero: if (N[i.b] == 0.0f) pc = i.a; break;
+        case FastOp::JumpIfNotLess: if (!(N[i.b] < N[i.c])) pc = i.a; break;
+        case FastOp::JumpIfNotLessOrEqual: if (!(N[i.b] <= N[i.c])) pc = i.a; break;
+        case FastOp::JumpIfNotGreater: if (!(N[i.b] > N[i.c])) pc = i.a; break;
+        case FastOp::JumpIfNotGreaterOrEqual: if (!(N[i.b] >= N[i.c])) pc = i.a; break;
+        case FastOp::JumpIfNotEqual: if (!(N[i.b] == N[i.c])) pc = i.a; break;
+        case FastOp::JumpIfEqual: if (!(N[i.b] != N[i.c])) pc = i.a; break;
+
+        case FastOp::Gosub:
+            returns.push_back(pc);
+            pc = i.a;
+            if (interrupted())
+                return;
+            break;
+
+        case FastOp::Return:
+            if (returns.empty())
+            {
+                fail("Stack underflow");
+                return;
+            }
+            pc = returns.back();
+            returns.pop_back();
+            if (interrupted())
+                return;
+            break;
+
+        case FastOp::On:
+        {
+            // The out of range value continues the execution, same as in the interpreter
+            int index = (int)N[i.a] - 1;
+            if (index >= 0 && index < i.c)
+            {
+                int target = fastProgram.jumpTables[i.b + index];
+                if (target < 0)
+                {
+                    fail("ON - line not found");
+                    return;
+                }
+                if (i.d)
+                    returns.push_back(pc);
+                pc = target;
+                if (interrupted())
+                    return;
+            }
+            break;
+        }
+
+        case FastOp::For:
+            loops.push_back({ i.a, N[i.b], N[i.c], pc });
+            break;
+
+        case FastOp::Next:
+        {
+            if (loops.empty())
+            {
+                fail("NEXT without FOR");
+                return;
+            }
+            int var = i.a < 0 ? loops.back().var : i.a;
+            while (!loops.empty() && loops.back().var != var)
+                loops.pop_back();
+            if (loops.empty())
+            {
+                fail("NEXT without FOR");
+                return;
+            }
+
+            tFastLoop& loop = loops.back();
+            tNumber val = N[var] + loop.step;
+            N[var] = val;
+            if ((val - loop.limit) * loop.step <= 0)
+            {
+                if (loop.body == (size_t)i.b)
+                {
+                    // Loop without a body, must be a delay loop
+                    int count = loop.step == 0 ? 1 : (int)((loop.limit - val + loop.step) / loop.step);
+                    if (count > 0)
+                    {
+                        this_thread::sleep_for(chrono::milliseconds(count));
+                        N[var] = val + count * loop.step;
+                        loops.pop_back();
+                    }
+                }
+                else
+                {
+                    size_t from = pc - 1;
+                    pc = loop.body;
+                    if (interrupted())
+                        return;
+                    if (pc <= from)
+                    {
+                        bool loopDone;
+                        pc = ExecuteJit(from, pc, var, loop.limit, loop.step, loopDone);
+                        if (loopDone)
+                            loops.pop_back();
+                    }
+                }
+            }
+            else
+                loops.pop_back();
+            break;
+        }
+
+        case FastOp::EvalCondition:
+        case FastOp::EvalNumber:
+        {
+            const vector<int>* used = FastHandOff(pc - 1);
+            setLine(fastProgram.lines[pc - 1]);
+            FastSyncOut(used);
+            if (inErrorCondition)
+                return;
+            const byte* expression = programImage.data() + i.b;
+            auto val = EvaluateExpression(expression);
+            if (executionPointer.lineNum <= kCommandLine)
+            {
+                if (used != nullptr)
+                    FastSyncOut();
+                return;
+            }
+
+            bool condition = i.code == FastOp::EvalCondition;
+            if (val.size() == 1 && val[0].IsNumeric())
+                N[i.a] = condition ? (tNumber)(val[0].Number() != 0.0f) : val[0].Number();
+            else if (val.size() == 1 && condition && holds_alternative<string>(val[0]))
+                N[i.a] = (tNumber)(get<string>(val[0]).length() > 0);
+            else
+            {
+                fail(condition ? "Bad IF expression" : fastProgram.messages[i.d]);
+                return;
+            }
+            break;
+        }
+
+        case FastOp::Interpret:
+        {
+            // When the program stops here, the variables the statement did not use get their values as well
+            const vector<int>* used = FastHandOff(pc - 1);
+            setLine(i.b);
+            FastSyncOut(used);
+            if (inErrorCondition)
+                return;
+            executionPointer.offset = i.c;
+            const byte* instruction = programImage.data() + i.a;
+            (this->*instructionInfo[(int)*instruction].do_execute)(instruction + 1);
+            FastSyncIn(used);
+            if (executionPointer.lineNum <= kCommandLine)
+            {
+                if (used != nullptr)
+                    FastSyncOut();
+                return;
+            }
+            break;
+        }
+
+        case FastOp::Error:
+            fail(fastProgram.messages[i.d]);
+            return;
+
+        case FastOp::End:
+            setLine(fastProgram.lines[pc - 1]);
+            FastSyncOut();
+            ExecuteEnd(nullptr);
+            return;
+        }
+    }
+}
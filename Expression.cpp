@@ -56,7 +56,8 @@ void BasicMachine::DecodeToken(string& s, const byte*& parms, const tUserFunctio
 {
     switch (GetNextTokenType(parms))
     {
-    case TokenType::ttNumber:   DecodeNumber(s, parms); return;
+    case TokenType::ttNumber:
+    case TokenType::ttInteger:  DecodeNumber(s, parms); return;
     case TokenType::ttString:   DecodeStringQuoted(s, parms); return;
     case TokenType::ttOp:       DecodeOperation(s, parms); return;
     case TokenType::ttVariable: DecodeVariable(s, parms); return;
@@ -64,7 +65,7 @@ void BasicMachine::DecodeToken(string& s, const byte*& parms, const tUserFunctio
     case TokenType::ttSystemVar: DecodeSysVar(s, parms); return;
     case TokenType::ttFunction: DecodeFunction(s, parms); return;
     case TokenType::ttUserFunction: DecodeUserFunction(s, parms); return;
-    case TokenType::ttExpression:  s += '('; DecodeExpression(s, parms);  s += ')'; return;
+    case TokenType::ttExpression:  s += '('; DecodeExpression(s, parms, context);  s += ')'; return;
     case TokenType::ttParameterRef: DecodeParameterRef(s, parms, *context); return;
     }
 }
@@ -86,6 +87,104 @@ int BasicMachine::DecodeOperation(const byte*& parms)
     return (int)*parms++;
 }
 
+void BasicMachine::SkipToken(const byte*& parms)
+{
+    switch (GetNextTokenType(parms))
+    {
+    case TokenType::ttNumber:   parms += 1 + sizeof(tNumber); return; // type and number
+    case TokenType::ttInteger:  parms += 5; return; // type and int
+    case TokenType::ttVariable: parms += kVariableTokenSize; return;
+    case TokenType::ttString:
+    case TokenType::ttExpression:
+        ++parms;
+        parms += DecodeParmsLength(parms);
+        return;
+    default:                    parms += 2; return; // type and one byte of index or operation
+    }
+}
+
+// The expression gets converted to the postfix order right after parsing using Shunting Yard algorithm-lite - no need
+// to care about parentheses or functions as those are nested expressions. This is also the place where binary +/- are
+// converted into unary ones, the token itself is updated (listing is not affected as the names are the same).
+bool BasicMachine::EncodePostfix(tStatement& s, size_t infix)
+{
+    size_t start = infix + SizeOfParmsLength();
+    if (s.size() - start > 255) // Offsets are stored in single bytes
+        return false;
+
+    vector<byte> postfix;
+    vector<pair<byte, int>> opStack; // Offset and operation code
+
+    TokenType lastTokenType = TokenType::ttNone;
+
+    const byte* parms = s.data() + start;
+    const byte* limit = s.data() + s.size();
+    while (parms < limit)
+    {
+        byte offset = (byte)(parms - (s.data() + start));
+        TokenType currentTokenType = GetNextTokenType(parms);
+        if (currentTokenType == TokenType::ttOp)
+        {
+            int op = (int)parms[1];
+            if (lastTokenType == TokenType::ttOp || lastTokenType == TokenType::ttNone)
+            {
+                if (operatorInfo[op].unaryNext)
+                    s[start + (int)offset + 1] = (byte)++op;
+            }
+
+            if (operatorInfo[op].separator) // comma or semicolon complete the current component of the expression
+            {
+                while (!opStack.empty())
+                {
+                    postfix.push_back(opStack.back().first);
+                    opStack.pop_back();
+                }
+                postfix.push_back(offset);
+            }
+            else
+            {
+                if (operatorInfo[op].rightAssociative)
+                {
+                    while (!opStack.empty() && operatorInfo[opStack.back().second].precedence > operatorInfo[op].precedence)
+                    {
+                        postfix.push_back(opStack.back().first);
+                        opStack.pop_back();
+                    }
+                }
+                else
+                {
+                    while (!opStack.empty() && operatorInfo[opStack.back().second].precedence >= operatorInfo[op].precedence)
+                    {
+                        postfix.push_back(opStack.back().first);
+                        opStack.pop_back();
+                    }
+                }
+                opStack.push_back({ offset, op });
+            }
+        }
+        else
+            postfix.push_back(offset);
+
+        SkipToken(parms);
+
+        // Arrays and functions take the following expression with them
+        if ((currentTokenType == TokenType::ttArray || currentTokenType == TokenType::ttFunction || currentTokenType == TokenType::ttUserFunction) &&
+            parms < limit && GetNextTokenType(parms) == TokenType::ttExpression)
+            SkipToken(parms);
+
+        lastTokenType = currentTokenType;
+    }
+
+    while (!opStack.empty())
+    {
+        postfix.push_back(opStack.back().first);
+        opStack.pop_back();
+    }
+
+    s.insert(s.end(), postfix.begin(), postfix.end());
+    return true;
+}
+
 void BasicMachine::DecodeFunction(string& s, const byte*& parms)
 {
     s += functionInfo[DecodeFunction(parms)].name;
@@ -103,7 +202,8 @@ bool BasicMachine::TryParseExpression(tStatement& s, const char*& ptr, const tUs
 {
     size_t restoreSize = s.size();
     s.push_back((byte)TokenType::ttExpression);
-    int off = ReserveParmsLength(s);
+    size_t off = ReserveParmsLength(s);
+    size_t infix = ReserveParmsLength(s);
 
     TokenType prevToken;
     if ((prevToken = TryParseNextToken(s, ptr, context)) == TokenType::ttNone) // there should be at least one token
@@ -152,7 +252,7 @@ bool BasicMachine::TryParseExpression(tStatement& s, const char*& ptr, const tUs
         ErrorCondition("Syntax error");
         return false;
     }
-    if (!EncodeParmsLength(s, off))
+    if (!EncodeParmsLength(s, infix) || !EncodePostfix(s, infix) || !EncodeParmsLength(s, off))
     {
         ErrorCondition("The expression is too complex");
         return false;
@@ -165,12 +265,17 @@ void BasicMachine::DecodeExpression(string& s, const byte*& parms, const tUserFu
     ++parms; // skip token type
     int length = DecodeParmsLength(parms);
     const byte* limit = parms + length;
-    while (parms < limit)
+    int infixLength = DecodeParmsLength(parms);
+    const byte* infixLimit = parms + infixLength;
+    while (parms < infixLimit)
         DecodeToken(s, parms, context);
+    parms = limit; // skip the postfix part
 }
 
 BasicMachine::tValue BasicMachine::EvaluateNumber(const byte*& parms)
 {
+    if (GetNextTokenType(parms) == TokenType::ttInteger)
+        return tValue::Integer(DecodeInteger(parms));
     return DecodeNumber(parms);
 }
 
@@ -183,18 +288,65 @@ BasicMachine::tValue BasicMachine::EvaluateString(const byte*& parms)
 
 BasicMachine::tValue BasicMachine::EvaluateVariable (const byte*& parms, const byte* limit)
 {
-    return vars[DecodeVariable(parms)].value;
+    const tValue& val = vars[DecodeVariable(parms)].value;
+    if (holds_alternative<string>(val))
+        ++stats.stringCopies;
+    return val;
 }
 
 BasicMachine::tValue BasicMachine::EvaluateParameterRef(const byte*& parms, const byte* limit, const tUserFunctionInfo* context)
 {
-    return context->parms[DecodeParameterRef(parms, *context)].value;
+    const tValue& val = context->parms[DecodeParameterRef(parms, *context)].value;
+    if (holds_alternative<string>(val))
+        ++stats.stringCopies;
+    return val;
 }
 
 BasicMachine::tValue BasicMachine::EvaluateArray(const byte*& parms, const byte* limit, const tUserFunctionInfo* context)
 {
     int index = DecodeArray(parms);
-    return ArrayGet((byte)index, EvaluateExpression(parms, context));
+    int i = EvaluateArrayIndex((byte)index, parms, context);
+    if (i < 0)
+        return tValue();
+    tValue val = ArrayElement(arrays[index], i);
+    if (holds_alternative<string>(val))
+        ++stats.stringCopies;
+    return val;
+}
+
+// Same as EvaluateExpression, but the indexes go on the stack kept for them and only the element index comes back,
+// so an array access allocates nothing. An access nested in the indexes uses the stack above them. -1 after an error
+int BasicMachine::EvaluateArrayIndex(byte ar, const byte*& parms, const tUserFunctionInfo* context)
+{
+    ++stats.expressions;
+    ++parms;
+    int length = DecodeParmsLength(parms);
+    const byte* limit = parms + length;
+    int infixLength = DecodeParmsLength(parms);
+    const byte* infix = parms;
+    const byte* infixLimit = infix + infixLength;
+
+    size_t base = indexStack.size();
+    bool valid = EvaluatePostfix(infix, infixLimit, infixLimit, limit, indexStack, context);
+    parms = limit;
+
+    int index = -1;
+    for (size_t i = base; valid && i < indexStack.size(); ++i)
+        if (holds_alternative<tError>(indexStack[i]))
+        {
+            const char* message = get<tError>(indexStack[i]).message;
+            ErrorCondition(message == nullptr ? "Bad expression" : message);
+            valid = false;
+        }
+    if (valid)
+    {
+        index = ElementIndex(arrays[(int)ar], indexStack.data() + base, indexStack.size() - base);
+        if (index < 0)
+            ErrorCondition("Bad array index");
+    }
+
+    indexStack.erase(indexStack.begin() + base, indexStack.end());
+    return index;
 }
 
 BasicMachine::tValue BasicMachine::EvaluateSysVar(const byte*& parms, const byte* limit)
@@ -212,6 +364,11 @@ BasicMachine::tValue BasicMachine::EvaluateFunction(const byte*& parms, const by
     {
         auto arg = EvaluateExpression(parms, context);
 
+        // The functions work on floats
+        for (auto& a : arg)
+            if (holds_alternative<int>(a))
+                a = a.Number();
+
         if (functionInfo[functionCode].do_eval != nullptr)
             return functionInfo[functionCode].do_eval(*this, arg);
     }
@@ -238,13 +395,15 @@ BasicMachine::tValue BasicMachine::EvaluateUserFunction(const byte*& parms, cons
     {
         for (size_t i = 0; i < context.parms.size(); ++i)
         {
-            if (context.parms[i].value.index() != args[2 * i].index() ||
+            if (!Assignable(context.parms[i].value, args[2 * i]) ||
                 (i > 0 && !holds_alternative<tSeparator>(args[2*i-1])))
             {
                 ErrorCondition("Bad argument type in user function");
                 return tValue();
             }
 
+            if (context.parms[i].value.index() != args[2 * i].index() && !ConvertNumber(context.parms[i].value, args[2 * i]))
+                return tValue();
             context.parms[i].value = args[2 * i];
         }
 
@@ -277,87 +436,21 @@ BasicMachine::tValue BasicMachine::EvaluateSubexpression(const byte*& parms, con
 
 BasicMachine::tExpressionValue BasicMachine::EvaluateExpression(const byte*& parms, const tUserFunctionInfo* context)
 {
-    // Shunting Yard algorithm-lite - no need to care about parentheses or functions
+    // The expression is in the postfix order already, so this is just a stack machine. The postfix part
+    // refers to the tokens in the infix part.
+    ++stats.expressions;
     ++parms;
     int length = DecodeParmsLength(parms);
     const byte* limit = parms + length;
+    int infixLength = DecodeParmsLength(parms);
+    const byte* infix = parms;
+    const byte* infixLimit = infix + infixLength;
 
     tExpressionValue result;
-
-    vector<int> opStack;
-
-    TokenType lastTokenType = TokenType::ttNone;
-
-    while (parms < limit)
-    {
-        TokenType currentTokenType = GetNextTokenType(parms);
-        switch (currentTokenType)
-        {
-        case TokenType::ttNumber: result.push_back(EvaluateNumber(parms)); break;
-        case TokenType::ttString: result.push_back(EvaluateString(parms)); break;
-        case TokenType::ttExpression: result.push_back(EvaluateSubexpression(parms, context)); break;
-        case TokenType::ttVariable: result.push_back(EvaluateVariable(parms, limit)); break;
-        case TokenType::ttArray: result.push_back(EvaluateArray(parms, limit, context)); break;
-        case TokenType::ttSystemVar: result.push_back(EvaluateSysVar(parms, limit)); break;
-        case TokenType::ttFunction: result.push_back(EvaluateFunction(parms, limit, context)); break;
-        case TokenType::ttUserFunction: result.push_back(EvaluateUserFunction(parms, limit, context)); break;
-        case TokenType::ttParameterRef: result.push_back(EvaluateParameterRef(parms, limit, context)); break;
-
-        case TokenType::ttOp:
-            {
-                // Not testing for leading operator as the parser will catch that
-                int op = DecodeOperation(parms);
-
-                // Convert binary +/- into unary
-                if (lastTokenType == TokenType::ttOp || lastTokenType == TokenType::ttNone)
-                {
-                    if (operatorInfo[op].unaryNext)
-                        ++op;
-                }
-
-                if (operatorInfo[op].separator) // comma or semicolon complete the current component of the expression
-                {
-                    while (!opStack.empty())
-                    {
-                        ComputeOperator(result, opStack.back());
-                        opStack.pop_back();
-                    }
-                    ComputeOperator(result, op);
-                    break;
-                }
-
-                if (operatorInfo[op].rightAssociative)
-                {
-                    while (!opStack.empty() && operatorInfo[opStack.back()].precedence > operatorInfo[op].precedence)
-                    {
-                        ComputeOperator(result, opStack.back());
-                        opStack.pop_back();
-                    }
-                }
-                else
-                {
-                    while (!opStack.empty() && operatorInfo[opStack.back()].precedence >= operatorInfo[op].precedence)
-                    {
-                        ComputeOperator(result, opStack.back());
-                        opStack.pop_back();
-                    }
-                }
-                opStack.push_back(op);
-            }
-            break;
-        default:
-            ErrorCondition("Bad expression");
-            return result;
-        }
-        lastTokenType = currentTokenType;
-    }
-
-    // Not checking trailing operator as the parser will catch that
-    while (!opStack.empty())
-    {
-        ComputeOperator(result, opStack.back());
-        opStack.pop_back();
-    }
+    bool valid = EvaluatePostfix(infix, infixLimit, infixLimit, limit, result, context);
+    parms = limit;
+    if (!valid)
+        return result;
 
     for (const auto& v : result)
         if (holds_alternative<tError>(v))
@@ -372,6 +465,34 @@ BasicMachine::tExpressionValue BasicMachine::EvaluateExpression(const byte*& par
     return result;
 }
 
+// Runs a range of the postfix part, false on a bad token
+bool BasicMachine::EvaluatePostfix(const byte* infix, const byte* infixLimit, const byte* postfix, const byte* limit,
+    tExpressionValue& result, const tUserFunctionInfo* context)
+{
+    for (; postfix < limit; ++postfix)
+    {
+        const byte* token = infix + (int)*postfix;
+        switch (GetNextTokenType(token))
+        {
+        case TokenType::ttNumber:
+        case TokenType::ttInteger: result.push_back(EvaluateNumber(token)); break;
+        case TokenType::ttString: result.push_back(EvaluateString(token)); break;
+        case TokenType::ttExpression: result.push_back(EvaluateSubexpression(token, context)); break;
+        case TokenType::ttVariable: result.push_back(EvaluateVariable(token, infixLimit)); break;
+        case TokenType::ttArray: result.push_back(EvaluateArray(token, infixLimit, context)); break;
+        case TokenType::ttSystemVar: result.push_back(EvaluateSysVar(token, infixLimit)); break;
+        case TokenType::ttFunction: result.push_back(EvaluateFunction(token, infixLimit, context)); break;
+        case TokenType::ttUserFunction: result.push_back(EvaluateUserFunction(token, infixLimit, context)); break;
+        case TokenType::ttParameterRef: result.push_back(EvaluateParameterRef(token, infixLimit, context)); break;
+        case TokenType::ttOp: ComputeOperator(result, DecodeOperation(token)); break;
+        default:
+            ErrorCondition("Bad expression");
+            return false;
+        }
+    }
+    return true;
+}
+
 void BasicMachine::ComputeComma(tExpressionValue& val) const
 {
     val.push_back(tSeparator(','));
@@ -384,34 +505,29 @@ void BasicMachine::ComputeSemicolon(tExpressionValue& val) const
 
 void BasicMachine::ComputeAdd(tExpressionValue& val) const
 {
-    if (val.size() > 1 && val.back().index() == val[val.size() - 2].index())
+    int64_t i, j;
+    tNumber a, b;
+    if (PrepareInteger(val, i, j))
+        val.push_back(IntegerResult(i + j));
+    else if (PrepareMath(val, a, b))
+        val.push_back(a + b);
+    else if (val.size() > 1 && holds_alternative<string>(val.back()) && holds_alternative<string>(val[val.size() - 2]))
     {
-        if (holds_alternative<float>(val.back()))
-        {
-            float b = get<float>(val.back());
-            val.pop_back();
-            float a = get<float>(val.back());
-            val.pop_back();
-            val.push_back(a + b);
-            return;
-        }
-        else if (holds_alternative<string>(val.back()))
-        {
-            string b = get<string>(val.back());
-            val.pop_back();
-            string a = get<string>(val.back());
-            val.pop_back();
-            val.push_back(a + b);
-            return;
-        }
+        tValue s = move(val.back());
+        val.pop_back();
+        val.back() = tValue::Concat(get<string>(val.back()), get<string>(s));
     }
-    val.push_back(tError());
+    else
+        val.push_back(tError());
 }
 
 void BasicMachine::ComputeSubtract(tExpressionValue& val) const
 {
-    float a, b;
-    if (PrepareMath(val, a, b))
+    int64_t i, j;
+    tNumber a, b;
+    if (PrepareInteger(val, i, j))
+        val.push_back(IntegerResult(i - j));
+    else if (PrepareMath(val, a, b))
         val.push_back(a - b);
     else
         val.push_back(tError());
@@ -419,8 +535,11 @@ void BasicMachine::ComputeSubtract(tExpressionValue& val) const
 
 void BasicMachine::ComputeMultiply(tExpressionValue& val) const
 {
-    float a, b;
-    if (PrepareMath(val, a, b))
+    int64_t i, j;
+    tNumber a, b;
+    if (PrepareInteger(val, i, j))
+        val.push_back(IntegerResult(i * j));
+    else if (PrepareMath(val, a, b))
         val.push_back(a * b);
     else
         val.push_back(tError());
@@ -428,7 +547,7 @@ void BasicMachine::ComputeMultiply(tExpressionValue& val) const
 
 void BasicMachine::ComputeDivide(tExpressionValue& val) const
 {
-    float a, b;
+    tNumber a, b;
     if (PrepareMath(val, a, b))
     {
         if (b == 0.0)
@@ -443,7 +562,7 @@ void BasicMachine::ComputeDivide(tExpressionValue& val) const
 
 void BasicMachine::ComputePower(tExpressionValue& val) const
 {
-    float a, b;
+    tNumber a, b;
     if (PrepareMath(val, a, b))
         val.push_back(pow(a, b));
     else
@@ -454,7 +573,7 @@ void BasicMachine::ComputeLessOrEqual(tExpressionValue& val) const
 {
     auto res = ComputeCompare(val);
     if (res.second)
-        val.push_back((float)(res.first <= 0));
+        val.push_back((tNumber)(res.first <= 0));
     else
         val.push_back(tError());
 }
@@ -463,7 +582,7 @@ void BasicMachine::ComputeGreaterOrEqual(tExpressionValue& val) const
 {
     auto res = ComputeCompare(val);
     if (res.second)
-        val.push_back((float)(res.first >= 0));
+        val.push_back((tNumber)(res.first >= 0));
     else
         val.push_back(tError());
 }
@@ -472,7 +591,7 @@ void BasicMachine::ComputeNotEqual(tExpressionValue& val) const
 {
     auto res = ComputeCompare(val);
     if (res.second)
-        val.push_back((float)(res.first != 0));
+        val.push_back((tNumber)(res.first != 0));
     else
         val.push_back(tError());
 }
@@ -481,7 +600,7 @@ void BasicMachine::ComputeLess(tExpressionValue& val) const
 {
     auto res = ComputeCompare(val);
     if (res.second)
-        val.push_back((float)(res.first < 0));
+        val.push_back((tNumber)(res.first < 0));
     else
         val.push_back(tError());
 }
@@ -490,7 +609,7 @@ void BasicMachine::ComputeGreater(tExpressionValue& val) const
 {
     auto res = ComputeCompare(val);
     if (res.second)
-        val.push_back((float)(res.first > 0));
+        val.push_back((tNumber)(res.first > 0));
     else
         val.push_back(tError());
 }
@@ -499,7 +618,7 @@ void BasicMachine::ComputeEqual(tExpressionValue& val) const
 {
     auto res = ComputeCompare(val);
     if (res.second)
-        val.push_back((float)(res.first == 0));
+        val.push_back((tNumber)(res.first == 0));
     else
         val.push_back(tError());
 }
@@ -508,7 +627,7 @@ void BasicMachine::ComputeAnd(tExpressionValue& val) const
 {
     bool a, b;
     if (PrepareLogical(val, a, b))
-        val.push_back((float)(a && b));
+        val.push_back((tNumber)(a && b));
     else
         val.push_back(tError());
 }
@@ -517,7 +636,7 @@ void BasicMachine::ComputeOr(tExpressionValue& val) const
 {
     bool a, b;
     if (PrepareLogical(val, a, b))
-        val.push_back((float)(a || b));
+        val.push_back((tNumber)(a || b));
     else
         val.push_back(tError());
 }
@@ -526,17 +645,17 @@ void BasicMachine::ComputeNot(tExpressionValue& val) const
 {
     if (val.size() > 0)
     {
-        if (holds_alternative<float>(val.back()))
+        if (val.back().IsNumeric())
         {
-            auto a = get<float>(val.back());
+            auto a = val.back().Number();
             val.pop_back();
-            val.push_back((float)(a == 0.0f));
+            val.push_back((tNumber)(a == 0.0f));
         }
         else if (holds_alternative<string>(val.back()))
         {
-            auto a = get<string>(val.back());
+            bool empty = get<string>(val.back()).empty();
             val.pop_back();
-            val.push_back((float(a.size() == 0)));
+            val.push_back((tNumber)empty);
         }
         else
             val.push_back(tError());
@@ -555,9 +674,11 @@ void BasicMachine::ComputeUnaryPlus(tExpressionValue& val) const
 
 void BasicMachine::ComputeUnaryMinus(tExpressionValue& val) const
 {
-    if (val.size() > 0 && holds_alternative<float>(val.back()))
+    if (val.size() > 0 && holds_alternative<int>(val.back()))
+        val.back() = IntegerResult(-(int64_t)get<int>(val.back()));
+    else if (val.size() > 0 && holds_alternative<tNumber>(val.back()))
     {
-        auto a = get<float>(val.back());
+        auto a = get<tNumber>(val.back());
         val.pop_back();
         val.push_back(-a);
     }
@@ -569,35 +690,48 @@ void BasicMachine::ComputeUnaryMinus(tExpressionValue& val) const
 
 pair<int, bool> BasicMachine::ComputeCompare(tExpressionValue& val) const
 {
+    int64_t i, j;
+    tNumber a, b;
+    if (PrepareInteger(val, i, j))
+        return { (i < j) ? -1 : (i > j) ? 1 : 0, true };
+    if (PrepareMath(val, a, b))
+        return { (a < b) ? -1 : (a > b) ? 1 : 0, true };
     if (val.size() > 1 && val.back().index() == val[val.size() - 2].index())
     {
-        if (holds_alternative<float>(val.back()))
-        {
-            float b = get<float>(val.back());
-            val.pop_back();
-            float a = get<float>(val.back());
-            val.pop_back();
-            return { (a < b) ? -1 : (a > b) ? 1 : 0, true };
-        }
-        else if (holds_alternative<string>(val.back()))
+        if (holds_alternative<string>(val.back()))
         {
-            string b = get<string>(val.back());
+            int result = get<string>(val[val.size() - 2]).compare(get<string>(val.back()));
             val.pop_back();
-            string a = get<string>(val.back());
             val.pop_back();
-            return { a.compare(b), true };
+            return { result, true };
         }
     }
     return { 0, false };
 }
 
-bool BasicMachine::PrepareMath(tExpressionValue& val, float& a, float& b) const
+// An integer operand goes with a float one as a float
+bool BasicMachine::PrepareMath(tExpressionValue& val, tNumber& a, tNumber& b) const
+{
+    if (val.size() > 1 && val.back().IsNumeric() && val[val.size() - 2].IsNumeric())
+    {
+        b = val.back().Number();
+        val.pop_back();
+        a = val.back().Number();
+        val.pop_back();
+        return true;
+    }
+    else
+        return false;
+}
+
+// Both operands are integers. The arithmetic is done in 64 bits, so the result of a single operation cannot overflow
+bool BasicMachine::PrepareInteger(tExpressionValue& val, int64_t& a, int64_t& b) const
 {
-    if (val.size() > 1 && holds_alternative<float>(val.back()) && holds_alternative<float>(val[val.size() - 2]))
+    if (val.size() > 1 && holds_alternative<int>(val.back()) && holds_alternative<int>(val[val.size() - 2]))
     {
-        b = get<float>(val.back());
+        b = get<int>(val.back());
         val.pop_back();
-        a = get<float>(val.back());
+        a = get<int>(val.back());
         val.pop_back();
         return true;
     }
@@ -605,19 +739,27 @@ bool BasicMachine::PrepareMath(tExpressionValue& val, float& a, float& b) const
         return false;
 }
 
+// Stays an integer when it fits, becomes a float otherwise
+BasicMachine::tValue BasicMachine::IntegerResult(int64_t value)
+{
+    if (value >= INT32_MIN && value <= INT32_MAX)
+        return tValue::Integer((int)value);
+    return (tNumber)value;
+}
+
 bool BasicMachine::PrepareLogical(tExpressionValue& val, bool& a, bool& b) const
 {
     if (val.size() > 1)
     {
-        if (holds_alternative<float>(val.back()))
-            b = get<float>(val.back()) != 0.0f;
+        if (val.back().IsNumeric())
+            b = val.back().Number() != 0.0f;
         else if (holds_alternative<string>(val.back()))
             b = get<string>(val.back()).length() > 0;
         else
             return false;
         val.pop_back();
-        if (holds_alternative<float>(val.back()))
-            a = get<float>(val.back()) != 0.0f;
+        if (val.back().IsNumeric())
+            a = val.back().Number() != 0.0f;
         else if (holds_alternative<string>(val.back()))
             a = get<string>(val.back()).length() > 0;
         else
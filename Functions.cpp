@@ -3,8 +3,8 @@
 
 BasicMachine::tValue BasicMachine::ComputeABS(const tExpressionValue& arg) const
 {
-    if (arg.size() == 1 && holds_alternative<float>(arg[0]))
-        return (float)fabs(get<float>(arg[0]));
+    if (arg.size() == 1 && holds_alternative<tNumber>(arg[0]))
+        return fabs(get<tNumber>(arg[0]));
     else
         return tError();
 }
@@ -12,24 +12,24 @@ BasicMachine::tValue BasicMachine::ComputeABS(const tExpressionValue& arg) const
 BasicMachine::tValue BasicMachine::ComputeASC(const tExpressionValue& arg) const
 {
     if (arg.size() == 1 && holds_alternative<string>(arg[0]))
-        return (float)get<string>(arg[0])[0];
+        return get<string>(arg[0]).empty() ? 0.0f : (tNumber)get<string>(arg[0])[0];
     else
         return tError();
 }
 
 BasicMachine::tValue BasicMachine::ComputeATN(const tExpressionValue& arg) const
 {
-    if (arg.size() == 1 && holds_alternative<float>(arg[0]))
-        return atanf(get<float>(arg[0]));
+    if (arg.size() == 1 && holds_alternative<tNumber>(arg[0]))
+        return atan(get<tNumber>(arg[0]));
     else
         return tError();
 }
 
 BasicMachine::tValue BasicMachine::ComputeCHR(const tExpressionValue& arg) const
 {
-    if (arg.size() == 1 && holds_alternative<float>(arg[0]))
+    if (arg.size() == 1 && holds_alternative<tNumber>(arg[0]))
     {
-        string result{ (char)get<float>(arg[0]) };
+        string result{ (char)get<tNumber>(arg[0]) };
         return result;
     }
     else
@@ -38,34 +38,43 @@ BasicMachine::tValue BasicMachine::ComputeCHR(const tExpressionValue& arg) const
 
 BasicMachine::tValue BasicMachine::ComputeCOS(const tExpressionValue& arg) const
 {
-    if (arg.size() == 1 && holds_alternative<float>(arg[0]))
-        return cosf(get<float>(arg[0]));
+    if (arg.size() == 1 && holds_alternative<tNumber>(arg[0]))
+        return cos(get<tNumber>(arg[0]));
     else
         return tError();
 }
 
 BasicMachine::tValue BasicMachine::ComputeEXP(const tExpressionValue& arg) const
 {
-    if (arg.size() == 1 && holds_alternative<float>(arg[0]))
-        return expf(get<float>(arg[0]));
+    if (arg.size() == 1 && holds_alternative<tNumber>(arg[0]))
+        return exp(get<tNumber>(arg[0]));
+    else
+        return tError();
+}
+
+// Free string space. Without the string heap there is no set limit, the largest number a program might check against
+BasicMachine::tValue BasicMachine::ComputeFRE(const tExpressionValue& arg) const
+{
+    if (arg.size() == 1)
+        return stringHeap.empty() ? 2147483647.0f : (tNumber)StringHeapFree();
     else
         return tError();
 }
 
 BasicMachine::tValue BasicMachine::ComputeINT(const tExpressionValue& arg) const
 {
-    if (arg.size() == 1 && holds_alternative<float>(arg[0]))
-        return floorf(get<float>(arg[0]));
+    if (arg.size() == 1 && holds_alternative<tNumber>(arg[0]))
+        return floor(get<tNumber>(arg[0]));
     else
         return tError();
 }
 
 BasicMachine::tValue BasicMachine::ComputeLEFT(const tExpressionValue& arg) const
 {
-    if (arg.size() == 3 && holds_alternative<string>(arg[0]) && holds_alternative<float>(arg[2]))
+    if (arg.size() == 3 && holds_alternative<string>(arg[0]) && holds_alternative<tNumber>(arg[2]))
     {
         int len = get<string>(arg[0]).length();
-        return get<string>(arg[0]).substr(0, min((int)get<float>(arg[2]), len));
+        return arg[0].Slice(0, min((int)get<tNumber>(arg[2]), len));
     }
     else
         return tError();
@@ -74,39 +83,40 @@ BasicMachine::tValue BasicMachine::ComputeLEFT(const tExpressionValue& arg) cons
 BasicMachine::tValue BasicMachine::ComputeLEN(const tExpressionValue& arg) const
 {
     if (arg.size() == 1 && holds_alternative<string>(arg[0]))
-        return (float)get<string>(arg[0]).length();
+        return (tNumber)get<string>(arg[0]).length();
     else
         return tError();
 }
 
 BasicMachine::tValue BasicMachine::ComputeLOG(const tExpressionValue& arg) const
 {
-    if (arg.size() == 1 && holds_alternative<float>(arg[0]))
-        return logf(get<float>(arg[0]));
+    if (arg.size() == 1 && holds_alternative<tNumber>(arg[0]))
+        return log(get<tNumber>(arg[0]));
     else
         return tError();
 }
 
 BasicMachine::tValue BasicMachine::ComputeMID(const tExpressionValue& arg) const
 {
-    bool valid = (arg.size() == 3 || arg.size() == 5) && holds_alternative<string>(arg[0]) && holds_alternative<float>(arg[2]);
+    bool valid = (arg.size() == 3 || arg.size() == 5) && holds_alternative<string>(arg[0]) && holds_alternative<tNumber>(arg[2]);
 
     if (valid)
     {
         int len = get<string>(arg[0]).length();
-        int from = min(len, (int)get<float>(arg[2])) - 1;
+        int from = min(len, (int)get<tNumber>(arg[2])) - 1;
+        valid = from >= 0;
 
         int count = len - from;
 
         if (arg.size() == 5)
         {
-            valid = valid && holds_alternative<float>(arg[4]);
+            valid = valid && holds_alternative<tNumber>(arg[4]);
             if(valid)
-                count = min(len - from, (int)get<float>(arg[4]));
+                count = min(len - from, (int)get<tNumber>(arg[4]));
         }
 
         if(valid)
-            return get<string>(arg[0]).substr(from, count);
+            return arg[0].Slice(from, count);
     }
 
     return tError();
@@ -114,18 +124,18 @@ BasicMachine::tValue BasicMachine::ComputeMID(const tExpressionValue& arg) const
 
 BasicMachine::tValue BasicMachine::ComputeRND(const tExpressionValue& arg) const
 {
-    if (arg.size() == 1 && holds_alternative<float>(arg[0]))
-        return ((float)rand())/RAND_MAX;
+    if (arg.size() == 1 && holds_alternative<tNumber>(arg[0]))
+        return ((tNumber)rand())/RAND_MAX;
     else
         return tError();
 }
 
 BasicMachine::tValue BasicMachine::ComputeRIGHT(const tExpressionValue& arg) const
 {
-    if (arg.size() == 3 && holds_alternative<string>(arg[0]) && holds_alternative<float>(arg[2]))
+    if (arg.size() == 3 && holds_alternative<string>(arg[0]) && holds_alternative<tNumber>(arg[2]))
     {
         int len = get<string>(arg[0]).length();
-        return get<string>(arg[0]).substr(max(0, len-(int)get<float>(arg[2])), string::npos);
+        return arg[0].Slice(max(0, len-(int)get<tNumber>(arg[2])), string::npos);
     }
     else
         return tError();
@@ -133,34 +143,34 @@ BasicMachine::tValue BasicMachine::ComputeRIGHT(const tExpressionValue& arg) con
 
 BasicMachine::tValue BasicMachine::ComputeSGN(const tExpressionValue& arg) const
 {
-    if (arg.size() == 1 && holds_alternative<float>(arg[0]))
-        return get<float>(arg[0]) < 0 ? (float)-1 : (float)1;
+    if (arg.size() == 1 && holds_alternative<tNumber>(arg[0]))
+        return get<tNumber>(arg[0]) < 0 ? (tNumber)-1 : (tNumber)1;
     else
         return tError();
 }
 
 BasicMachine::tValue BasicMachine::ComputeSIN(const tExpressionValue& arg) const
 {
-    if (arg.size() == 1 && holds_alternative<float>(arg[0]))
-        return sinf(get<float>(arg[0]));
+    if (arg.size() == 1 && holds_alternative<tNumber>(arg[0]))
+        return sin(get<tNumber>(arg[0]));
     else
         return tError();
 }
 
 BasicMachine::tValue BasicMachine::ComputeSQR(const tExpressionValue& arg) const
 {
-    if (arg.size() == 1 && holds_alternative<float>(arg[0]))
-        return sqrtf(get<float>(arg[0]));
+    if (arg.size() == 1 && holds_alternative<tNumber>(arg[0]))
+        return sqrt(get<tNumber>(arg[0]));
     else
         return tError();
 }
 
 BasicMachine::tValue BasicMachine::ComputeSTR(const tExpressionValue& arg) const
 {
-    if (arg.size() == 1 && holds_alternative<float>(arg[0]))
+    if (arg.size() == 1 && holds_alternative<tNumber>(arg[0]))
     {
         char buf[30];
-        sprintf(buf, "%g", get<float>(arg[0]));
+        sprintf(buf, "%.*g", tBasicPolicy::printDigits, get<tNumber>(arg[0]));
         return string(buf);
     }
     else
@@ -169,9 +179,9 @@ BasicMachine::tValue BasicMachine::ComputeSTR(const tExpressionValue& arg) const
 
 BasicMachine::tValue BasicMachine::ComputeTAB(const tExpressionValue& arg) const
 {
-    if (arg.size() == 1 && holds_alternative<float>(arg[0]))
+    if (arg.size() == 1 && holds_alternative<tNumber>(arg[0]))
     {
-        return tTab((int)get<float>(arg[0]));
+        return tTab((int)get<tNumber>(arg[0]));
     }
     else
         return tError();
@@ -179,8 +189,8 @@ BasicMachine::tValue BasicMachine::ComputeTAB(const tExpressionValue& arg) const
 
 BasicMachine::tValue BasicMachine::ComputeTAN(const tExpressionValue& arg) const
 {
-    if (arg.size() == 1 && holds_alternative<float>(arg[0]))
-        return tanf(get<float>(arg[0]));
+    if (arg.size() == 1 && holds_alternative<tNumber>(arg[0]))
+        return tan(get<tNumber>(arg[0]));
     else
         return tError();
 }
@@ -188,7 +198,7 @@ BasicMachine::tValue BasicMachine::ComputeTAN(const tExpressionValue& arg) const
 BasicMachine::tValue BasicMachine::ComputeVAL(const tExpressionValue& arg) const
 {
     if (arg.size() == 1 && holds_alternative<string>(arg[0]))
-        return (float)atof(get<string>(arg[0]).c_str());
+        return (tNumber)atof(string(get<string>(arg[0])).c_str());
     else
         return tError();
 }
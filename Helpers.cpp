@@ -2,7 +2,6 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
-#include <conio.h>
 
 #include "Basic.h"
 
@@ -13,13 +12,14 @@ void BasicMachine::ErrorCondition(const char* description)
         return;
 
     if (executionPointer.lineNum > kCommandLine)
-        printf("%s on line %d\n", description, executionPointer.lineNum);
+        OutputFormat("%s on line %d\n", description, executionPointer.lineNum);
     else
-        puts(description);
+        OutputLine(description);
 
+    TraceReset();
     executionPointer.lineNum = kCommandLine;
     executionPointer.offset = 0;
-    executionPointer.cachedStatement = program.end();
+    executionPointer.line = 0;
     executionPointer.skipForNext = false;
     commandLine.clear();
     stack.clear();
@@ -28,10 +28,9 @@ void BasicMachine::ErrorCondition(const char* description)
 }
 
 
-void BasicMachine::AdvanceExecutionPointer()
+size_t BasicMachine::CurrentStatementSize() const
 {
-    const byte* lengthPtr = executionPointer.lineNum > kCommandLine ? &executionPointer.cachedStatement->second[executionPointer.offset + 1] : &commandLine[executionPointer.offset + 1];
-    executionPointer.offset += DecodeParmsLength(lengthPtr) + 1 + SizeOfParmsLength();
+    return executionPointer.lineNum > kCommandLine ? programLines[executionPointer.line].size : commandLine.size();
 }
 
 void BasicMachine::IgnoreSpaces(const char*& ptr)
@@ -122,7 +121,7 @@ bool BasicMachine::TryParseNumber(tStatement& s, const char*& ptr)
     if (*ptr && (isdigit(*ptr) || ((*ptr == '-' || *ptr == '.') && isdigit(*(ptr + 1)))))
     {
         int sign = 1;
-        int mantissa = 0;
+        int64_t mantissa = 0;
         int impl_exponent = 0;
         int exponent = 0;
         int signexp = 1;
@@ -133,16 +132,17 @@ bool BasicMachine::TryParseNumber(tStatement& s, const char*& ptr)
         }
         while (isdigit(*ptr))
         {
-            if (mantissa > INT_MAX / 10)
+            if (mantissa > INT64_MAX / 10)
                 return false;
             mantissa = mantissa * 10 + (*ptr++ - '0');
         }
+        bool hasPoint = *ptr == '.' || toupper(*ptr) == 'E';
         if (*ptr == '.')
         {
             ++ptr;
             while (isdigit(*ptr))
             {
-                if (mantissa > INT_MAX / 10)
+                if (mantissa > INT64_MAX / 10)
                     return false;
                 mantissa = mantissa * 10 + (*ptr++ - '0');
                 --impl_exponent;
@@ -164,10 +164,22 @@ bool BasicMachine::TryParseNumber(tStatement& s, const char*& ptr)
             }
         }
 
+        // Whole numbers stay exact
+        if (impl_exponent == 0 && exponent == 0 && !hasPoint && mantissa <= INT_MAX)
+        {
+            s.push_back((byte)TokenType::ttInteger);
+            int whole = (int)mantissa * sign;
+            for (int i = 0; i < 4; ++i)
+                s.push_back(*((byte*)&whole + i));
+            return true;
+        }
+
         s.push_back((byte)TokenType::ttNumber);
 
-        float fract = (float)(mantissa * pow(10, signexp * exponent + impl_exponent)) * sign;
-        for (int i = 0; i < 4; ++i)
+        // Dividing by the exact power of ten keeps 0.1 and the like correctly rounded for doubles
+        int power = signexp * exponent + impl_exponent;
+        tNumber fract = (tNumber)(power < 0 ? mantissa / pow(10, -power) : mantissa * pow(10, power)) * sign;
+        for (size_t i = 0; i < sizeof(tNumber); ++i)
             s.push_back(*((byte*)&fract + i));
         return true;
     }
@@ -177,7 +189,7 @@ bool BasicMachine::TryParseNumber(tStatement& s, const char*& ptr)
 void BasicMachine::DecodeString(string& s, const byte*& parms)
 {
     ++parms; // skip token type
-    int len = (int)*parms++;
+    int len = DecodeParmsLength(parms);
     for (int i = 0; i < len; ++i)
         s += (char)*parms++;
 }
@@ -192,15 +204,28 @@ void BasicMachine::DecodeStringQuoted(string& s, const byte*& parms)
 
 void BasicMachine::DecodeNumber(string& s, const byte*& parms)
 {
-    char buf[20];
-    sprintf(buf, "%g", DecodeNumber(parms));
+    char buf[30];
+    if (*parms == (byte)TokenType::ttInteger)
+        sprintf(buf, "%d", DecodeInteger(parms));
+    else
+        sprintf(buf, "%.*g", tBasicPolicy::printDigits, DecodeNumber(parms));
     s += buf;
 }
 
-float BasicMachine::DecodeNumber(const byte*& parms)
+tNumber BasicMachine::DecodeNumber(const byte*& parms)
+{
+    if (*parms == (byte)TokenType::ttInteger)
+        return (tNumber)DecodeInteger(parms);
+    ++parms;
+    tNumber res = *(tNumber*)parms;
+    parms += sizeof(tNumber);
+    return res;
+}
+
+int BasicMachine::DecodeInteger(const byte*& parms)
 {
     ++parms;
-    float res = *(float*)parms;
+    int res = *(int*)parms;
     parms += 4;
     return res;
 }
@@ -233,11 +258,11 @@ BasicMachine::TokenType BasicMachine::TryParseSymbol(tStatement& s, const char*&
     if (isalpha(*ptr))
     {
         string symbol;
-        while (isalnum(*ptr) || *ptr == '$')
+        while (isalnum(*ptr) || *ptr == '$' || *ptr == '%')
         {
             char c = toupper(*ptr++);
             symbol.push_back(c);
-            if (c == '$')
+            if (c == '$' || c == '%')
                 break;
             // Special case - some interpreters allowed space after FN
             if (symbol.length() == 2 && symbol.compare("FN") == 0)
@@ -253,7 +278,7 @@ BasicMachine::TokenType BasicMachine::TryParseSymbol(tStatement& s, const char*&
                 if (itU == userFunctions.end())
                 {
                     index = userFunctions.size();
-                    if (index >= 256)
+                    if (index >= tBasicPolicy::maxUserFunctions)
                     {
                         ErrorCondition("Too many user functions");
                         return TokenType::ttNone;
@@ -276,22 +301,10 @@ BasicMachine::TokenType BasicMachine::TryParseSymbol(tStatement& s, const char*&
                 return TokenType::ttFunction;
             }
 
+            int index = ArrayIndex(symbol);
+            if (index < 0)
+                return TokenType::ttNone;
             s.push_back((byte)TokenType::ttArray);
-            int index;
-            auto itA = find_if(arrays.begin(), arrays.end(), [&symbol](const auto& e) { return symbol.compare(e.name) == 0; });
-            if (itA == arrays.end())
-            {
-                index = arrays.size();
-                if (index >= 256)
-                {
-                    ErrorCondition("Too many arrays");
-                    return TokenType::ttNone;
-                }
-                arrays.push_back({ symbol });
-                ArrayDefaultCreate((byte)index);
-            }
-            else
-                index = itA - arrays.begin();
             s.push_back((byte)index);
             return TokenType::ttArray;
         }
@@ -322,15 +335,17 @@ BasicMachine::TokenType BasicMachine::TryParseSymbol(tStatement& s, const char*&
             if (itV == vars.end())
             {
                 index = vars.size();
-                if (index >= 65536) // Very unlikely...
+                if (index >= tBasicPolicy::maxVariables) // Very unlikely...
                 {
                     ErrorCondition("Too many variables");
                     return TokenType::ttNone;
                 }
                 if (symbol.back() == '$')
                     vars.push_back({ symbol, string() });
+                else if (symbol.back() == '%')
+                    vars.push_back({ symbol, tValue::Integer(0) });
                 else
-                    vars.push_back({ symbol, float(0.0) });
+                    vars.push_back({ symbol, tNumber(0.0) });
             }
             else
                 index = itV - vars.begin();
@@ -342,17 +357,41 @@ BasicMachine::TokenType BasicMachine::TryParseSymbol(tStatement& s, const char*&
     return TokenType::ttNone;
 }
 
+// Array name without the parentheses, as MAT statements have it
+bool BasicMachine::TryParseArrayName(tStatement& s, const char*& ptr)
+{
+    IgnoreSpaces(ptr);
+    if (!isalpha(*ptr))
+        return false;
+
+    string symbol;
+    while (isalnum(*ptr) || *ptr == '$' || *ptr == '%')
+    {
+        char c = toupper(*ptr++);
+        symbol.push_back(c);
+        if (c == '$' || c == '%')
+            break;
+    }
+
+    int index = ArrayIndex(symbol);
+    if (index < 0)
+        return false;
+    s.push_back((byte)TokenType::ttArray);
+    s.push_back((byte)index);
+    return true;
+}
+
 bool BasicMachine::TryParseParameter(tStatement& s, const char*& ptr, tUserFunctionInfo& context)
 {
     IgnoreSpaces(ptr);
     if (isalpha(*ptr))
     {
         string symbol;
-        while (isalnum(*ptr) || *ptr == '$')
+        while (isalnum(*ptr) || *ptr == '$' || *ptr == '%')
         {
             char c = toupper(*ptr++);
             symbol.push_back(c);
-            if (c == '$')
+            if (c == '$' || c == '%')
                 break;
         }
 
@@ -364,8 +403,10 @@ bool BasicMachine::TryParseParameter(tStatement& s, const char*& ptr, tUserFunct
 
         if (symbol.back() == '$')
             context.parms.push_back({ symbol, string() });
+        else if (symbol.back() == '%')
+            context.parms.push_back({ symbol, tValue::Integer(0) });
         else
-            context.parms.push_back({ symbol, float(0.0) });
+            context.parms.push_back({ symbol, tNumber(0.0) });
         return true;
     }
 
@@ -398,8 +439,10 @@ void BasicMachine::DecodeParameter(string& s, const byte*& parms, tUserFunctionI
 
     if (symbol.back() == '$')
         context.parms.push_back({ symbol, string() });
+    else if (symbol.back() == '%')
+        context.parms.push_back({ symbol, tValue::Integer(0) });
     else
-        context.parms.push_back({ symbol, float(0.0) });
+        context.parms.push_back({ symbol, tNumber(0.0) });
 }
 
 void BasicMachine::DecodeParameterRef(string& s, const byte*& parms, const tUserFunctionInfo& context) const
@@ -528,18 +571,21 @@ const char* BasicMachine::ParmsToName(const byte* parms)
     return instructionInfo[(int)parms[-1]].name;
 }
 
+// The length is two bytes. One byte used to be enough but expressions carry their postfix form as well now.
 size_t BasicMachine::ReserveParmsLength(tStatement& s)
 {
     size_t result{ s.size() };
-    s.push_back((byte)0);
+    s.insert(s.end(), SizeOfParmsLength(), (byte)0);
     return result;
 }
 
 bool BasicMachine::EncodeParmsLength(tStatement& s, size_t where)
 {
-    if (s.size() - where - 1 <= 255)
+    size_t length = s.size() - where - SizeOfParmsLength();
+    if (length <= 65535)
     {
-        s[where] = (byte)(s.size() - where - 1);
+        s[where] = (byte)(length & 255);
+        s[where + 1] = (byte)(length >> 8);
         return true;
     }
     return false;
@@ -547,12 +593,14 @@ bool BasicMachine::EncodeParmsLength(tStatement& s, size_t where)
 
 int BasicMachine::DecodeParmsLength(const byte*& parms)
 {
-    return (int)*parms++;
+    int result = (int)parms[0] + ((int)parms[1] << 8);
+    parms += 2;
+    return result;
 }
 
 int BasicMachine::SizeOfParmsLength()
 {
-    return 1;
+    return 2;
 }
 
 string BasicMachine::ListStatement(tLineNumber lineNum, const tStatement& statement)
@@ -586,28 +634,3 @@ string BasicMachine::ListStatement(tLineNumber lineNum, const tStatement& statem
 
     return result;
 }
-
-char BasicMachine::TestKeyboard()
-{
-    if (executionPointer.lineNum == kCommandLine)
-    {
-        lastKey = 0;
-        return 0;
-    }
-
-    // Do actual keyboard poll every few statements, otherwise short loops with INKEY$ will not work well
-    static int counter = 0;
-    if (counter)
-    {
-        --counter;
-        return 0;
-    }
-    counter = 10;
-
-    if (_kbhit())
-        lastKey = (char)_getch();
-    else
-        lastKey = 0;
-
-    return lastKey;
-}
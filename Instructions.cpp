@@ -1,9 +1,11 @@
 #define _CRT_SECURE_NO_WARNINGS
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #include "Basic.h"
 
+#include <algorithm>
 #include <chrono>
 #include <thread>
 
@@ -16,6 +18,7 @@ void BasicMachine::ExecuteBye(const byte* parms)
     executionPointer.lineNum = kShutdown;
     stack.clear();
     program.clear();
+    programLinked = false;
     commandLine.clear();
 }
 
@@ -23,7 +26,7 @@ void BasicMachine::ExecuteBye(const byte* parms)
 void BasicMachine::ExecuteCls(const byte* parms)
 {
     // This is a weird trick that just recently started working on Windows.
-    printf("\033c");
+    Output("\033c");
 }
 
 // DATA {number|string}[,...]
@@ -55,7 +58,7 @@ string BasicMachine::ListData(const byte* parms) const
         if(count++)
             result += ',';
 
-        if (GetNextTokenType(parms) == TokenType::ttNumber)
+        if (IsNumberToken(GetNextTokenType(parms)))
             DecodeNumber(result, parms);
         else
             DecodeStringQuoted(result, parms);
@@ -157,7 +160,8 @@ void BasicMachine::ExecuteDim(const byte* parms)
         {
             int arIndex = DecodeArray(parms);
             auto val = EvaluateExpression(parms);
-            ArrayCreate((byte)arIndex, val);
+            if (!ArrayCreate((byte)arIndex, val))
+                ErrorCondition("Bad array dimensions");
         }
         else
             DecodeVariable(parms);
@@ -206,7 +210,7 @@ bool BasicMachine::ParseElse(tStatement& result, const char*& ptr)
 void BasicMachine::ExecuteElse(const byte* parms)
 {
     (void)DecodeParmsLength(parms);
-    if (executionPointer.offset < executionPointer.cachedStatement->second.size())
+    if (executionPointer.offset < CurrentStatementSize())
     {
         // Skipping over IF and other statements differ
         if (instructionInfo[(int)*parms].ifStatement)
@@ -215,15 +219,15 @@ void BasicMachine::ExecuteElse(const byte* parms)
             (void)DecodeParmsLength(parms);
             size_t offsetElse = *(size_t*)parms;
             if (offsetElse == 0)
-                executionPointer.offset = executionPointer.cachedStatement->second.size(); // IF with no ELSE, just skip to the end of the statement
+                executionPointer.offset = CurrentStatementSize(); // IF with no ELSE, just skip to the end of the statement
             else
-                executionPointer.offset = offsetElse - 2; // Pass to ELSE in that IF so a chained ELSE IF will also work
+                executionPointer.offset = offsetElse - 1 - SizeOfParmsLength(); // Pass to ELSE in that IF so a chained ELSE IF will also work
         }
         else
         {
             ++parms;
             int length = DecodeParmsLength(parms);
-            executionPointer.offset += length + 2; // TODO: hardcoded opcode/length size
+            executionPointer.offset += length + 1 + SizeOfParmsLength();
         }
     }
 }
@@ -231,14 +235,15 @@ void BasicMachine::ExecuteElse(const byte* parms)
 // END
 void BasicMachine::ExecuteEnd(const byte* parms)
 {
+    TraceReset();
     executionPointer.lineNum = kCommandLine;
     executionPointer.offset = 0;
-    executionPointer.cachedStatement = program.end();
+    executionPointer.line = 0;
     executionPointer.skipForNext = false;
 
     readPointer.lineNum = kCommandLine;
     readPointer.offset = 0;
-    readPointer.cachedStatement = program.end();
+    readPointer.line = programLines.size();
     readPointer.itemOffset = -1;
     readPointer.limit = 0;
 
@@ -269,15 +274,19 @@ void BasicMachine::ExecuteFor(const byte* parms)
     (void)DecodeParmsLength(parms);
     unsigned short index = (unsigned short)DecodeVariable(parms);
     auto initVal = EvaluateExpression(parms);
-    if (initVal.size() == 1 && holds_alternative<float>(initVal[0]))
+    if (initVal.size() == 1 && initVal[0].IsNumeric())
     {
-        vars[index].value = initVal[0];
-        float initial = get<float>(initVal[0]);
-        float limit = get<float>(EvaluateExpression(parms)[0]);
-        float step = GetNextTokenType(parms) == TokenType::ttNone ? (float)1.0 : get<float>(EvaluateExpression(parms)[0]);
+        StoreValue(vars[index].value, initVal[0]);
+        tNumber initial = initVal[0].Number();
+        tNumber limit = EvaluateExpression(parms)[0].Number();
+        tNumber step = GetNextTokenType(parms) == TokenType::ttNone ? (tNumber)1.0 : EvaluateExpression(parms)[0].Number();
+        if (holds_alternative<int>(vars[index].value))
+            step = round(step); // NEXT adds it exactly
         if (bAnsiFor && (initial - limit) * step > 0)
             executionPointer.skipForNext = true;
         loopStack.push_back({ index, limit, step, executionPointer });
+        if (tracing)
+            TraceEvent(kTraceFor, true, index);
     }
     else
         ErrorCondition("Malformed FOR loop");
@@ -312,13 +321,20 @@ bool BasicMachine::ParseGoto(tStatement& result, const char*& ptr)
 void BasicMachine::ExecuteGoto(const byte* parms)
 {
     (void)DecodeParmsLength(parms);
-    executionPointer.lineNum = DecodeLineNum(parms);
-    executionPointer.offset = 0;
-    executionPointer.cachedStatement = program.find(executionPointer.lineNum);
-    if (executionPointer.cachedStatement == program.end())
+    size_t line = ResolveLine(DecodeLineNum(parms));
+    if (line < programLines.size())
+        JumpToLine(line);
+    else
         ErrorCondition("GOTO - line not found");
 }
 
+// GOTO to a line known to exist, the operand is already the line index
+void BasicMachine::ExecuteGotoLine(const byte* parms)
+{
+    (void)DecodeParmsLength(parms);
+    JumpToLine(DecodeLineNum(parms));
+}
+
 string BasicMachine::ListGoto(const byte* parms) const
 {
     string result{ ParmsToName(parms) };
@@ -329,6 +345,12 @@ string BasicMachine::ListGoto(const byte* parms) const
     return result;
 }
 
+void BasicMachine::LinkGoto(byte* parms)
+{
+    parms += SizeOfParmsLength();
+    LinkLineNum(parms);
+}
+
 // GOSUB ushort
 bool BasicMachine::ParseGosub(tStatement& result, const char*& ptr)
 {
@@ -337,13 +359,16 @@ bool BasicMachine::ParseGosub(tStatement& result, const char*& ptr)
 
 void BasicMachine::ExecuteGosub(const byte* parms)
 {
-    stack.push_back(executionPointer);
-
     (void)DecodeParmsLength(parms);
-    executionPointer.lineNum = DecodeLineNum(parms);
-    executionPointer.offset = 0;
-    executionPointer.cachedStatement = program.find(executionPointer.lineNum);
-    if (executionPointer.cachedStatement == program.end())
+    size_t line = ResolveLine(DecodeLineNum(parms));
+    if (line < programLines.size())
+    {
+        if (tracing)
+            TraceEvent(kTraceGosub, true, programLines[line].lineNum);
+        stack.push_back(executionPointer);
+        JumpToLine(line);
+    }
+    else
         ErrorCondition("GOSUB - line not found");
 }
 
@@ -389,8 +414,8 @@ void BasicMachine::ExecuteIf(const byte* parms)
     if (val.size() == 1)
     {
         bool cond = false;
-        if (holds_alternative<float>(val[0]))
-            cond = get<float>(val[0]) != 0.0f;
+        if (val[0].IsNumeric())
+            cond = val[0].Number() != 0.0f;
         else if (holds_alternative<string>(val[0]))
             cond = get<string>(val[0]).length() > 0;
         else
@@ -408,6 +433,30 @@ void BasicMachine::ExecuteIf(const byte* parms)
         ErrorCondition("Bad IF expression");
 }
 
+// IF operand comparison operand
+void BasicMachine::ExecuteIfCompare(const byte* parms)
+{
+    (void)DecodeParmsLength(parms);
+    size_t offsetElse = *(size_t*)parms;
+    parms += sizeof(executionPointer.offset) + 1 + 2 * SizeOfParmsLength();
+
+    tNumber left = DecodeNumericOperand(parms);
+    const char* op = operatorInfo[(int)parms[1]].name;
+    parms += 2;
+    tNumber right = DecodeNumericOperand(parms);
+
+    bool cond;
+    switch (op[0])
+    {
+    case '<': cond = op[1] == '=' ? left <= right : op[1] == '>' ? left != right : left < right; break;
+    case '>': cond = op[1] == '=' ? left >= right : left > right; break;
+    default:  cond = left == right; break;
+    }
+
+    if (!cond)
+        executionPointer.offset = offsetElse ? offsetElse : SIZE_MAX;
+}
+
 string BasicMachine::ListIf(const byte* parms) const
 {
     string result{ ParmsToName(parms) };
@@ -465,16 +514,25 @@ void BasicMachine::ExecuteInput(const byte* parms)
         {
             string prompt;
             DecodeString(prompt, parms);
-            printf(prompt.c_str());
+            Output(prompt);
 
             if (*parms++ == (byte)1)
-                putchar('?');
+                Output('?');
         }
         else
-            putchar('?');
+            Output('?');
+
+        if (outputFlush & kFlushInput)
+            FlushOutput(true);
 
         char buffer[256];
+        if (tracing)
+            TraceEvent(kTraceInput, true, 0);
+        PauseKeyboard();
         gets_s(buffer, 256);
+        ResumeKeyboard();
+        if (tracing)
+            TraceEvent(kTraceInput, false, 0);
         const char* ptr = buffer;
 
         vector<string> items;
@@ -506,7 +564,7 @@ void BasicMachine::ExecuteInput(const byte* parms)
         {
             if (index >= items.size())
             {
-                puts("?Redo from start"); // Actual text from MS BASIC
+                OutputLine("?Redo from start"); // Actual text from MS BASIC
                 query = true;
                 break;
             }
@@ -515,19 +573,20 @@ void BasicMachine::ExecuteInput(const byte* parms)
             if (GetNextTokenType(parms) == TokenType::ttArray)
             {
                 int arIndex = DecodeArray(parms);
-                if (holds_alternative<string>(arrays[arIndex].value[0]))
-                    ArraySet((byte)arIndex, EvaluateExpression(parms), items[index]);
-                else
-                    ArraySet((byte)arIndex, EvaluateExpression(parms), (float)atof(items[index].c_str()));
+                int i = EvaluateArrayIndex((byte)arIndex, parms);
+                if (i >= 0 && arrays[arIndex].name.back() == '$')
+                    ArraySet((byte)arIndex, i, items[index]);
+                else if (i >= 0)
+                    ArraySet((byte)arIndex, i, (tNumber)atof(items[index].c_str()));
             }
             else
             {
                 int varIndex = DecodeVariable(parms);
 
-                if (holds_alternative<float>(vars[varIndex].value))
-                    vars[varIndex].value = (float)atof(items[index].c_str());
+                if (vars[varIndex].value.IsNumeric())
+                    StoreValue(vars[varIndex].value, (tNumber)atof(items[index].c_str()));
                 else
-                    vars[varIndex].value = items[index];
+                    StoreValue(vars[varIndex].value, items[index]);
             }
             ++index;
         }
@@ -612,10 +671,12 @@ void BasicMachine::ExecuteLet(const byte* parms)
     if (GetNextTokenType(parms) == TokenType::ttArray)
     {
         int arIndex = DecodeArray(parms);
-        tExpressionValue index = EvaluateExpression(parms);
+        int i = EvaluateArrayIndex((byte)arIndex, parms);
+        if (i < 0)
+            return;
         tExpressionValue val = EvaluateExpression(parms);
         if (val.size() == 1)
-            ArraySet((byte)arIndex, index, val[0]);
+            ArraySet((byte)arIndex, i, val[0]);
         else
             ErrorCondition("Bad assignment value");
     }
@@ -624,13 +685,72 @@ void BasicMachine::ExecuteLet(const byte* parms)
         int index = DecodeVariable(parms);
 
         tExpressionValue val = EvaluateExpression(parms);
-        if (val.size() == 1 && vars[index].value.index() == val[0].index())
-            vars[index].value = val[0];
+        if (val.size() == 1 && Assignable(vars[index].value, val[0]))
+            StoreValue(vars[index].value, move(val[0]));
         else
             ErrorCondition("Bad assignment value");
     }
 }
 
+// X=X+operand, X=X-operand
+void BasicMachine::ExecuteLetAdd(const byte* parms)
+{
+    (void)DecodeParmsLength(parms);
+    int index = DecodeVariable(parms);
+    parms += 1 + 2 * SizeOfParmsLength() + kVariableTokenSize; // Skip to the operator, the variable is known to be the same
+    bool subtract = operatorInfo[(int)parms[1]].name[0] == '-';
+    parms += 2;
+    tNumber operand = DecodeNumericOperand(parms);
+    tNumber& value = get<tNumber>(vars[index].value);
+    value = subtract ? value - operand : value + operand;
+}
+
+// A$=A$+expression, the variable's string grows in place
+void BasicMachine::ExecuteLetAppend(const byte* parms)
+{
+    (void)DecodeParmsLength(parms);
+    int index = DecodeVariable(parms);
+
+    // The postfix part starts with the variable and ends with the addition, the appended value is in between
+    ++stats.expressions;
+    ++parms;
+    int length = DecodeParmsLength(parms);
+    const byte* limit = parms + length;
+    int infixLength = DecodeParmsLength(parms);
+    const byte* infixLimit = parms + infixLength;
+
+    tExpressionValue val;
+    if (!EvaluatePostfix(parms, infixLimit, infixLimit + 1, limit - 1, val, nullptr))
+        return;
+    if (val.size() == 1 && holds_alternative<string>(val[0]))
+        AppendValue(vars[index].value, val[0]);
+    else if (val.size() == 1 && holds_alternative<tError>(val[0]) && get<tError>(val[0]).message != nullptr)
+        ErrorCondition(get<tError>(val[0]).message);
+    else
+        ErrorCondition("Bad expression");
+}
+
+// A(operand)=expression
+void BasicMachine::ExecuteLetArray(const byte* parms)
+{
+    (void)DecodeParmsLength(parms);
+    tArrayInfo& ar = arrays[DecodeArray(parms)];
+    const byte* operandPtr = parms + 1 + 2 * SizeOfParmsLength();
+    int i = (int)DecodeNumericOperand(operandPtr);
+    SkipToken(parms);
+    if (ar.dimensions.size() != 1 || i < 0 || i >= ar.dimensions[0])
+    {
+        ErrorCondition("Bad array index");
+        return;
+    }
+
+    tExpressionValue val = EvaluateExpression(parms);
+    if (val.size() != 1)
+        ErrorCondition("Bad assignment value");
+    else if (!StoreArrayElement(ar, i, move(val[0])))
+        ErrorCondition("Bad value type");
+}
+
 string BasicMachine::ListLet(const byte* parms) const
 {
     string result{ ParmsToName(parms) };
@@ -684,7 +804,7 @@ void BasicMachine::ExecuteList(const byte* parms)
 
     for (auto it = from; it != to; ++it)
     {
-        puts(ListStatement(it->first, it->second).c_str());
+        OutputLine(ListStatement(it->first, it->second).c_str());
     }
 }
 
@@ -723,8 +843,7 @@ void BasicMachine::ExecuteLoad(const byte* parms)
             char buff[257];
             buff[0] = 0;
             fgets(buff, 257, fin);
-            if (buff[strlen(buff) - 1] == '\n')
-                buff[strlen(buff) - 1] = 0;
+            buff[strcspn(buff, "\r\n")] = 0;
 
             if (strlen(buff) == 0)
                 continue;
@@ -734,15 +853,18 @@ void BasicMachine::ExecuteLoad(const byte* parms)
             
             if (inErrorCondition)
             {
-                puts(buff);
+                OutputLine(buff);
                 for (int i = ptr - buff; i > 0; --i)
-                    putchar(' ');
-                putchar('^'); putchar('\n');
+                    Output(' ');
+                OutputLine("^");
                 break;
             }
 
             if (parsed.first > kCommandLine)
+            {
                 program[parsed.first] = parsed.second;
+                programLinked = false;
+            }
             else
             {
                 ErrorCondition("Invalid line in the source file");
@@ -774,6 +896,7 @@ void BasicMachine::ExecuteNew(const byte* parms)
         ExecuteEnd(nullptr);
 
     program.clear();
+    programLinked = false;
     stack.clear();
     loopStack.clear();
     userFunctions.clear();
@@ -826,11 +949,27 @@ void BasicMachine::ExecuteNext(const byte* parms)
 
             if (!loopStack.empty())
             {
-                float val = get<float>(vars[index].value);
-                float limit = get<1>(loopStack.back());
-                float step = get<2>(loopStack.back());
-                val += step;
-                vars[index].value = val;
+                tValue& counter = vars[index].value;
+                tNumber limit = get<1>(loopStack.back());
+                tNumber step = get<2>(loopStack.back());
+                tNumber val;
+                if (holds_alternative<int>(counter))
+                {
+                    // An integer counter counts exactly
+                    int64_t next = (int64_t)get<int>(counter) + (int64_t)step;
+                    if (next < INT32_MIN || next > INT32_MAX)
+                    {
+                        ErrorCondition("Overflow");
+                        return;
+                    }
+                    counter = tValue::Integer((int)next);
+                    val = (tNumber)next;
+                }
+                else
+                {
+                    val = get<tNumber>(counter) + step;
+                    counter = val;
+                }
                 if ((val - limit) * step <= 0)
                 {
                     const auto& newExecutionPointer = get<3>(loopStack.back());
@@ -847,7 +986,9 @@ void BasicMachine::ExecuteNext(const byte* parms)
                         {
                             this_thread::sleep_for(chrono::milliseconds(loops));
                             loopStack.pop_back();
-                            vars[index].value = val + loops * step;
+                            if (tracing)
+                                TraceEvent(kTraceFor, false, index);
+                            StoreValue(vars[index].value, val + loops * step);
                         }
                     }
                     else
@@ -858,7 +999,11 @@ void BasicMachine::ExecuteNext(const byte* parms)
                     }
                 }
                 else
+                {
                     loopStack.pop_back();
+                    if (tracing)
+                        TraceEvent(kTraceFor, false, index);
+                }
             }
             else
             {
@@ -916,24 +1061,30 @@ void BasicMachine::ExecuteOn(const byte* parms)
     int length = DecodeParmsLength(parms);
     const byte* limit = parms + length;
     auto val = EvaluateExpression(parms);
-    if (val.size() == 1 && holds_alternative<float>(val[0]))
+    if (val.size() == 1 && val[0].IsNumeric())
     {
-        // GOSUB vs GOTO logic differs just by this one line
-        if(*parms++ == (byte)1)
-            stack.push_back(executionPointer);
+        bool gosub = *parms++ == (byte)1;
 
         // Get the proper index and make sure there is an entry for it after GOTO/GOSUB
-        int index = (int)get<float>(val[0]) - 1;
+        int index = (holds_alternative<int>(val[0]) ? get<int>(val[0]) : (int)get<tNumber>(val[0])) - 1;
         if (index >= 0 && index < (limit - parms) / 2)
         {
             for (; index; --index)
                 DecodeLineNum(parms);
 
-            // Execute GOTO logic
-            executionPointer.lineNum = DecodeLineNum(parms);
-            executionPointer.offset = 0;
-            executionPointer.cachedStatement = program.find(executionPointer.lineNum);
-            if (executionPointer.cachedStatement == program.end())
+            // Execute GOTO logic, GOSUB vs GOTO logic differs just by saving the return point
+            size_t line = ResolveLine(DecodeLineNum(parms));
+            if (line < programLines.size())
+            {
+                if (gosub)
+                {
+                    if (tracing)
+                        TraceEvent(kTraceGosub, true, programLines[line].lineNum);
+                    stack.push_back(executionPointer);
+                }
+                JumpToLine(line);
+            }
+            else
                 ErrorCondition("ON - line not found");
         }
         // The out of range value will cause the execution to continue (some documents refer to error condition on negative values)
@@ -963,6 +1114,19 @@ string BasicMachine::ListOn(const byte* parms) const
     return result;
 }
 
+void BasicMachine::LinkOn(byte* parms)
+{
+    const byte* lengthPtr = parms;
+    const byte* limit = lengthPtr + DecodeParmsLength(lengthPtr) + SizeOfParmsLength();
+    parms += SizeOfParmsLength();
+
+    // Skip the expression and GOTO/GOSUB tag
+    lengthPtr = parms + 1;
+    parms += DecodeParmsLength(lengthPtr) + 1 + SizeOfParmsLength() + 1;
+    while (parms < limit)
+        LinkLineNum(parms);
+}
+
 // PRINT [expression[[{,|;|}]expression]...]
 bool BasicMachine::ParsePrint(tStatement& result, const char*& ptr)
 {
@@ -980,67 +1144,87 @@ void BasicMachine::ExecutePrint(const byte* parms)
         if (inErrorCondition)
             return;
 
-        bool separated = true;
-        int prev = 2;
+        PrintValues(val);
 
-        string buffer;
-        char numBuff[20];
+        // Add semicolon or colon at the end of the argument list to prevent moving to the next line
+        if (holds_alternative<tSeparator>(val.back()))
+            return;
+    }
 
-        for (auto v : val)
+    printPos = 0;
+    OutputLine();
+}
+
+// The values and separators of PRINT, also the rows of MAT PRINT
+void BasicMachine::PrintValues(const tExpressionValue& val)
+{
+    string buffer;
+    char numBuff[30];
+
+    for (auto v : val)
+    {
+        if (holds_alternative<tSeparator>(v))
+        {
+            char c = get<tSeparator>(v).kind;
+            if (c == ',')
+            {
+                int offset = 8 - (printPos % 8);
+                printPos += offset;
+                for (; offset; --offset)
+                    buffer += ' ';
+            }
+        }
+        else
         {
-            if (holds_alternative<tSeparator>(v))
+            if (v.IsNumeric())
             {
-                char c = get<tSeparator>(v).kind;
-                if (c == ',')
+                if (v.Number() >= 0)
                 {
-                    int offset = 8 - (printPos % 8);
-                    printPos += offset;
-                    for (; offset; --offset)
-                        buffer += ' ';
+                    buffer += ' ';
+                    ++printPos;
                 }
+                sprintf(numBuff, "%.*g ", tBasicPolicy::printDigits, v.Number());
+                buffer += numBuff;
+                printPos += strlen(numBuff);
             }
-            else
+            else if (holds_alternative<string>(v))
+            {
+                buffer += get<string>(v);
+                printPos += get<string>(v).length();
+            }
+            else if (holds_alternative<tTab>(v))
             {
-                if (holds_alternative<float>(v))
+                printPos %= 80;
+                int offset = get<tTab>(v).offset - printPos;
+                if (offset > 0)
                 {
-                    if (get<float>(v) >= 0)
-                    {
+                    printPos += offset;
+                    for (; offset; --offset)
                         buffer += ' ';
-                        ++printPos;
-                    }
-                    sprintf(numBuff, "%g ", get<float>(v));
-                    buffer += numBuff;
-                    printPos += strlen(numBuff);
-                }
-                else if (holds_alternative<string>(v))
-                {
-                    buffer += get<string>(v);
-                    printPos += get<string>(v).length();
-                }
-                else if (holds_alternative<tTab>(v))
-                {
-                    printPos %= 80;
-                    int offset = get<tTab>(v).offset - printPos;
-                    if (offset > 0)
-                    {
-                        printPos += offset;
-                        for (; offset; --offset)
-                            buffer += ' ';
-                    }
                 }
             }
-            separated = holds_alternative<tSeparator>(v);
         }
+    }
 
-        printf(buffer.c_str());
+    Output(buffer);
+}
 
-        // Add semicolon or colon at the end of the argument list to prevent moving to the next line
-        if (holds_alternative<tSeparator>(val.back()))
-            return;
-    }
+// PRINT "literal" with an optional semicolon
+void BasicMachine::ExecutePrintString(const byte* parms)
+{
+    (void)DecodeParmsLength(parms);
+    int infixLength;
+    parms = DecodeInfix(parms, infixLength);
+    ++parms;
+    int length = DecodeParmsLength(parms);
+    Output((const char*)parms, length);
+    printPos += length;
 
-    printPos = 0;
-    puts("");
+    if (infixLength == length + 1 + SizeOfParmsLength())
+    {
+        printPos = 0;
+        OutputLine();
+    }
 }
 
 string BasicMachine::ListPrint(const byte* parms) const
@@ -1080,14 +1264,16 @@ void BasicMachine::ExecuteRead(const byte* parms)
         if (GetNextTokenType(parms) == TokenType::ttArray)
         {
             int arIndex = DecodeArray(parms);
-            ArraySet((byte)arIndex, EvaluateExpression(parms), val);
+            int i = EvaluateArrayIndex((byte)arIndex, parms);
+            if (i >= 0)
+                ArraySet((byte)arIndex, i, val);
         }
         else
         {
             int varIndex = DecodeVariable(parms);
  
-            if (vars[varIndex].value.index() == val.index())
-                vars[varIndex].value = val;
+            if (Assignable(vars[varIndex].value, val))
+                StoreValue(vars[varIndex].value, val);
             else
                 ErrorCondition("Bad data type");
         }
@@ -1148,18 +1334,18 @@ bool BasicMachine::ParseRestore(tStatement& result, const char*& ptr)
 
 void BasicMachine::ExecuteRestore(const byte* parms)
 {
-    unsigned short lineNum = kCommandLine;
+    size_t line = 0;
     if (DecodeParmsLength(parms) > 0)
-        lineNum = DecodeLineNum(parms);
-    else if (!program.empty())
-        lineNum = program.begin()->first;
+        line = ResolveLine(DecodeLineNum(parms));
+    else if (!programLinked)
+        LinkProgram();
 
-    readPointer.lineNum = lineNum;
+    readPointer.lineNum = line < programLines.size() ? programLines[line].lineNum : kCommandLine;
     readPointer.offset = 0;
-    readPointer.cachedStatement = program.find(lineNum);
+    readPointer.line = line;
     readPointer.itemOffset = -1;
     readPointer.limit = 0;
-    if (readPointer.cachedStatement == program.end())
+    if (readPointer.line >= programLines.size())
         ErrorCondition("No DATA for RESTORE");
 }
 
@@ -1174,6 +1360,16 @@ string BasicMachine::ListRestore(const byte* parms) const
     return result;
 }
 
+void BasicMachine::LinkRestore(byte* parms)
+{
+    const byte* lengthPtr = parms;
+    if (DecodeParmsLength(lengthPtr) > 0)
+    {
+        parms += SizeOfParmsLength();
+        LinkLineNum(parms);
+    }
+}
+
 // RETURN
 void BasicMachine::ExecuteReturn(const byte* parms)
 {
@@ -1183,31 +1379,59 @@ void BasicMachine::ExecuteReturn(const byte* parms)
     {
         executionPointer = stack.back();
         stack.pop_back();
+        if (tracing)
+            TraceEvent(kTraceGosub, false, 0);
     }
 }
 
-// RUN
+// RUN [FAST]
+bool BasicMachine::ParseRun(tStatement& result, const char*& ptr)
+{
+    IgnoreSpaces(ptr);
+    if (Match(ptr, "FAST"))
+        result.push_back((byte)1);
+    return true;
+}
+
+void BasicMachine::StartProgram()
+{
+    if (!programLinked)
+        LinkProgram();
+
+    JumpToLine(0);
+    executionPointer.skipForNext = false;
+
+    readPointer.line = executionPointer.line;
+    readPointer.lineNum = executionPointer.lineNum;
+    readPointer.offset = executionPointer.offset;
+    readPointer.itemOffset = -1;
+    readPointer.limit = 0;
+
+    ResetVars();
+    loopStack.clear();
+    stack.clear();
+}
+
 void BasicMachine::ExecuteRun(const byte* parms)
 {
     if (!program.empty())
     {
-        executionPointer.cachedStatement = program.begin();
-        executionPointer.lineNum = executionPointer.cachedStatement->first;
-        executionPointer.offset = 0;
-        executionPointer.skipForNext = false;
+        StartProgram();
 
-        readPointer.cachedStatement = executionPointer.cachedStatement;
-        readPointer.lineNum = executionPointer.lineNum;
-        readPointer.offset = executionPointer.offset;
-        readPointer.itemOffset = -1;
-        readPointer.limit = 0;
-
-        ResetVars();
-        loopStack.clear();
-        stack.clear();
+        // RUN FAST runs the whole program right here. If it cannot be compiled, the interpreter runs it as usual.
+        if (DecodeParmsLength(parms) > 0 && CompileFast())
+            ExecuteFast();
     }
 }
 
+string BasicMachine::ListRun(const byte* parms) const
+{
+    string result{ ParmsToName(parms) };
+    if (DecodeParmsLength(parms) > 0)
+        result += " FAST";
+    return result;
+}
+
 // SAVE string. In this dialect the string does not have to be quoted
 bool BasicMachine::ParseSave(tStatement& result, const char*& ptr)
 {
@@ -1258,9 +1482,9 @@ void BasicMachine::ExecuteRandomize(const byte* parms)
     if (DecodeParmsLength(parms) > 0)
     {
         auto val = EvaluateExpression(parms);
-        if (val.size() == 1 && holds_alternative<float>(val[0]))
+        if (val.size() == 1 && val[0].IsNumeric())
         {
-            srand((int)get<float>(val[0]));
+            srand((int)val[0].Number());
             return;
         }
         else
@@ -1309,13 +1533,15 @@ void BasicMachine::ExecuteDumpVars(const byte* parms)
 {
     for (const auto& v : vars)
     {
-        printf("%s = ", v.name.c_str());
-        if (holds_alternative<float>(v.value))
-            printf("%g\n", get<float>(v.value));
+        OutputFormat("%s = ", v.name.c_str());
+        if (holds_alternative<tNumber>(v.value))
+            OutputFormat("%.*g\n", tBasicPolicy::printDigits, get<tNumber>(v.value));
+        else if (holds_alternative<int>(v.value))
+            OutputFormat("%d\n", get<int>(v.value));
         else if (holds_alternative<string>(v.value))
-            printf("\"%s\"\n", get<string>(v.value).c_str());
+            OutputFormat("\"%.*s\"\n", (int)get<string>(v.value).length(), get<string>(v.value).data());
         else
-            printf("???\n");
+            OutputLine("???");
     }
 
     for (const auto& a : arrays)
@@ -1331,28 +1557,210 @@ void BasicMachine::ExecuteDumpVars(const byte* parms)
             s += _itoa(a.dimensions[i]-1, buff, 10);
         }
         s += ')';
-        puts(s.c_str());
+        OutputLine(s.c_str());
     }
 
     for(const auto& f : userFunctions)
     {
-        printf("%s", f.name.c_str());
+        Output(f.name);
         if (f.parms.size() > 0)
         {
             for (size_t i = 0; i < f.parms.size(); ++i)
-                printf("%c%s", i ? ',' : '(', f.parms[i].name.c_str());
+                OutputFormat("%c%s", i ? ',' : '(', f.parms[i].name.c_str());
         }
         else
-            putchar('(');
-        printf(")=");
+            Output('(');
+        Output(")=");
         if (f.body.empty())
-            printf("<not set>\n");
+            OutputLine("<not set>");
         else
         {
             string body;
             const byte* parms = f.body.data();
             DecodeExpression(body, parms, &f);
-            printf("%s\n", body.c_str());
+            OutputLine(body.c_str());
         }
     }
 }
+
+// PROFILE ON|OFF|REPORT|SAMPLE string
+bool BasicMachine::ParseProfile(tStatement& result, const char*& ptr)
+{
+    IgnoreSpaces(ptr);
+    if (Match(ptr, "ON"))
+        result.push_back((byte)1);
+    else if (Match(ptr, "OFF"))
+        result.push_back((byte)0);
+    else if (Match(ptr, "REPORT"))
+        result.push_back((byte)2);
+    else if (Match(ptr, "SAMPLE"))
+    {
+        result.push_back((byte)3);
+        return TryParseString(result, ptr);
+    }
+    else
+        return false;
+    return true;
+}
+
+void BasicMachine::ExecuteProfile(const byte* parms)
+{
+    (void)DecodeParmsLength(parms);
+    switch ((int)*parms)
+    {
+    case 0:
+        executeStatement = &BasicMachine::ExecuteAtPC;
+        if (!StopSampling())
+            ErrorCondition("Cannot write the samples");
+        break;
+
+    case 1:
+        // Starts over every time
+        profile.clear();
+        executeStatement = &BasicMachine::ExecuteAtPCProfiled;
+        break;
+
+    case 2:
+    {
+        vector<pair<pair<tLineNumber, size_t>, tProfileCounter>> sorted(profile.begin(), profile.end());
+        sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second.time > b.second.time; });
+        chrono::steady_clock::duration total{ 0 };
+        for (const auto& entry : sorted)
+            total += entry.second.time;
+
+        OutputLine(" LINE STMT       HITS    TIME MS      %  SOURCE");
+        for (const auto& entry : sorted)
+        {
+            tLineNumber lineNum = entry.first.first;
+            auto line = program.find(lineNum);
+
+            // Statement number within the line, from the offset
+            int statementNum = 1;
+            if (line != program.end())
+            {
+                for (size_t offset = 0; offset < entry.first.second; ++statementNum)
+                {
+                    const byte* lengthPtr = line->second.data() + offset + 1;
+                    offset += DecodeParmsLength(lengthPtr) + 1 + SizeOfParmsLength();
+                }
+            }
+
+            double ms = chrono::duration<double, milli>(entry.second.time).count();
+            OutputFormat("%5d %4d %10llu %10.3f %6.2f  ", lineNum, statementNum, (unsigned long long)entry.second.hits, ms,
+                total.count() > 0 ? 100.0 * entry.second.time.count() / total.count() : 0.0);
+            OutputLine(line != program.end() ? ListStatement(lineNum, line->second).c_str() : "");
+        }
+        break;
+    }
+
+    case 3:
+    {
+        string fileName;
+        DecodeString(fileName, ++parms);
+        StartSampling(fileName.c_str());
+        break;
+    }
+    }
+}
+
+// TRACE string|OFF
+bool BasicMachine::ParseTrace(tStatement& result, const char*& ptr)
+{
+    IgnoreSpaces(ptr);
+    return Match(ptr, "OFF") || TryParseString(result, ptr);
+}
+
+void BasicMachine::ExecuteTrace(const byte* parms)
+{
+    if (DecodeParmsLength(parms) == 0)
+    {
+        if (!StopTrace())
+            ErrorCondition("Cannot write the trace");
+        return;
+    }
+
+    string fileName;
+    DecodeString(fileName, parms);
+    StartTrace(fileName.c_str());
+}
+
+string BasicMachine::ListTrace(const byte* parms) const
+{
+    string result{ ParmsToName(parms) };
+    if (DecodeParmsLength(parms) == 0)
+        result += " OFF";
+    else
+    {
+        result += ' ';
+        DecodeStringQuoted(result, parms);
+    }
+    return result;
+}
+
+// STATS [RESET]
+bool BasicMachine::ParseStats(tStatement& result, const char*& ptr)
+{
+    IgnoreSpaces(ptr);
+    if (Match(ptr, "RESET"))
+        result.push_back((byte)1);
+    return true;
+}
+
+void BasicMachine::ExecuteStats(const byte* parms)
+{
+    if (DecodeParmsLength(parms) > 0)
+    {
+        ResetStats();
+        return;
+    }
+
+    // Taken first, the report itself allocates
+    tStats s = GetStats();
+
+    vector<pair<uint64_t, int>> statements;
+    for (int i = 0; i < (int)instructionInfo.size(); ++i)
+        if (s.statements[i] > 0)
+            statements.push_back({ s.statements[i], i });
+    sort(statements.rbegin(), statements.rend());
+
+    OutputLine("STATEMENTS");
+    for (const auto& statement : statements)
+    {
+        // The first two instructions are the assignment and the jump without a keyword
+        const tInstructionInfo& info = instructionInfo[statement.second];
+        OutputFormat("%16llu  %s%s\n", (unsigned long long)statement.first, *info.name ? info.name : statement.second == 0 ? "LET" : "GOTO",
+            *info.name == 0 ? " (implied)" : info.baseExecute != nullptr ? " (fused)" : "");
+    }
+    OutputFormat("%16llu  TOTAL\n", (unsigned long long)StatementCount());
+    OutputFormat("EXPRESSIONS      %llu\n", (unsigned long long)s.expressions);
+    OutputFormat("VALUE VECTORS    %llu\n", (unsigned long long)s.expressionVectors);
+    OutputFormat("STRING COPIES    %llu\n", (unsigned long long)s.stringCopies);
+    OutputFormat("LINE LOOKUPS     %llu\n", (unsigned long long)s.lineLookups);
+    OutputFormat("HEAP ALLOCATIONS %llu\n", (unsigned long long)s.heapAllocations);
+    OutputFormat("HEAP BYTES       %llu\n", (unsigned long long)s.heapBytes);
+}
+
+string BasicMachine::ListStats(const byte* parms) const
+{
+    string result{ ParmsToName(parms) };
+    if (DecodeParmsLength(parms) > 0)
+        result += " RESET";
+    return result;
+}
+
+string BasicMachine::ListProfile(const byte* parms) const
+{
+    string result{ ParmsToName(parms) };
+    (void)DecodeParmsLength(parms);
+    switch ((int)*parms++)
+    {
+    case 0: result += " OFF"; break;
+    case 1: result += " ON"; break;
+    case 2: result += " REPORT"; break;
+    case 3:
+        result += " SAMPLE ";
+        DecodeStringQuoted(result, parms);
+        break;
+    }
+    return result;
+}
@@ -0,0 +1,678 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+
+#include "Basic.h"
+
+#include <algorithm>
+#include <set>
+
+// Native code for the hot loops of RUN FAST. The bytecode VM counts back edges (NEXT going back to the loop body and
+// jumps going backwards) and once a loop gets hot, the instructions from the loop head to the back edge are translated
+// to x86-64 machine code. Only the numeric part of the bytecode is translated: arithmetic, comparisons, conditional
+// jumps, numeric arrays and functions. Every other instruction, jumps leaving the loop, bad array indexes and division
+// by zero become exits: the registers are stored back and the bytecode continues from that instruction, so all the
+// error reporting stays in one place. The code writes /tmp/perf-<pid>.map so perf can attribute samples to BASIC lines.
+
+static const unsigned kJitThreshold = 100; // Back edges before the loop is compiled
+static const int kJitBudget = 10000;       // Back edges between keyboard checks
+
+size_t BasicMachine::ExecuteJit(size_t backEdge, size_t head, int var, tNumber limit, tNumber step, bool& loopDone)
+{
+    tJitLoop& loop = fastProgram.jitLoops[backEdge];
+    loopDone = false;
+    if (loop.entry == nullptr)
+    {
+        if (loop.count == UINT_MAX || ++loop.count < kJitThreshold)
+            return head;
+        loop.entry = CompileJit(backEdge, head, var);
+        if (loop.entry == nullptr)
+        {
+            loop.count = UINT_MAX; // Do not try again
+            return head;
+        }
+        loop.var = var;
+    }
+
+    // NEXT without a variable may close different loops
+    if (loop.var != var)
+        return head;
+
+    // Arrays may be redimensioned at any time, the native code gets their current layout on every entry
+    jitArrays.resize(arrays.size());
+    for (size_t i = 0; i < arrays.size(); ++i)
+    {
+        const auto& dimensions = arrays[i].dimensions;
+        jitArrays[i].data = (byte*)arrays[i].numbers.data();
+        jitArrays[i].length = dimensions.size() == 1 ? dimensions[0] : 0;
+        jitArrays[i].rows = dimensions.size() == 2 ? dimensions[0] : 0;
+        jitArrays[i].columns = dimensions.size() == 2 ? dimensions[1] : 0;
+    }
+
+    tJitContext context{ fastProgram.numbers.data() + fastProgram.numberConstants, jitArrays.data(), limit, step, kJitBudget, 0 };
+    size_t pc = (size_t)loop.entry(&context);
+    loopDone = context.loopDone != 0;
+    return pc;
+}
+
+#if defined(_M_X64) || defined(__x86_64__)
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    enum Register { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RSI = 6, RDI = 7, R8 = 8, R9 = 9, R13 = 13, R14 = 14 };
+    enum Condition { CondB = 2, CondAE = 3, CondE = 4, CondNE = 5, CondBE = 6, CondA = 7, CondP = 10, CondNP = 11 };
+
+    // XMM0 and XMM1 are scratch, the rest hold the allocated registers. Windows preserves XMM6 and up across calls.
+#ifdef _WIN32
+    const int kJitRegisters = 4;
+#else
+    const int kJitRegisters = 14;
+#endif
+
+    // Just enough of the x86-64 encoding for the generator. Memory operands are always [base+disp32], the base
+    // is never RSP or R12 so there is no need for SIB.
+    struct tX64Code
+    {
+        vector<byte> code;
+        vector<size_t> labels;
+        vector<pair<size_t, int>> fixups;
+
+        void Byte(int b) { code.push_back((byte)b); }
+        void Int32(int v) { for (int i = 0; i < 4; ++i) Byte((v >> (8 * i)) & 255); }
+        void Int64(long long v) { for (int i = 0; i < 8; ++i) Byte((int)((v >> (8 * i)) & 255)); }
+
+        void Prefix(int prefix, bool wide, int reg, int rm, int opcode)
+        {
+            if (prefix)
+                Byte(prefix);
+            int rex = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+            if (rex != 0x40)
+                Byte(rex);
+            if (opcode > 255)
+                Byte(opcode >> 8);
+            Byte(opcode & 255);
+        }
+
+        void Op(int prefix, int opcode, bool wide, int reg, int rm)
+        {
+            Prefix(prefix, wide, reg, rm, opcode);
+            Byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+        }
+
+        void OpMem(int prefix, int opcode, bool wide, int reg, int base, int disp)
+        {
+            Prefix(prefix, wide, reg, base, opcode);
+            Byte(0x80 | ((reg & 7) << 3) | (base & 7));
+            Int32(disp);
+        }
+
+        void Push(int reg) { if (reg & 8) Byte(0x41); Byte(0x50 | (reg & 7)); }
+        void Pop(int reg) { if (reg & 8) Byte(0x41); Byte(0x58 | (reg & 7)); }
+
+        int Label()
+        {
+            labels.push_back(SIZE_MAX);
+            return (int)labels.size() - 1;
+        }
+
+        void Bind(int label) { labels[label] = code.size(); }
+
+        void Jump(int label)
+        {
+            Byte(0xE9);
+            fixups.push_back({ code.size(), label });
+            Int32(0);
+        }
+
+        void Jump(Condition condition, int label)
+        {
+            Byte(0x0F);
+            Byte(0x80 | condition);
+            fixups.push_back({ code.size(), label });
+            Int32(0);
+        }
+
+        void Resolve()
+        {
+            for (const auto& fixup : fixups)
+            {
+                int rel = (int)(labels[fixup.second] - (fixup.first + 4));
+                memcpy(&code[fixup.first], &rel, 4);
+            }
+        }
+    };
+
+    float JitPower(float a, float b)
+    {
+        return pow(a, b);
+    }
+}
+
+BasicMachine::tJitFunction BasicMachine::CompileJit(size_t backEdge, size_t head, int var)
+{
+    // The generated code is single precision, a double engine keeps the loops in the bytecode
+    if (!tBasicPolicy::nativeCode)
+        return nullptr;
+
+    const auto& code = fastProgram.code;
+
+    // The instructions translated to native code, with the numeric registers they read and write
+    auto operands = [](const tFastInstruction& i, vector<int>& reads, int& write)
+    {
+        reads.clear();
+        write = INT_MIN;
+        switch (i.code)
+        {
+        case FastOp::NMove: case FastOp::NNegate: case FastOp::NNot: case FastOp::NFunction:
+        case FastOp::NArrayLoad1:
+            reads = { i.b };
+            write = i.a;
+            return true;
+        case FastOp::NAdd: case FastOp::NSubtract: case FastOp::NMultiply: case FastOp::NDivide: case FastOp::NPower:
+        case FastOp::NAnd: case FastOp::NOr: case FastOp::NLess: case FastOp::NLessOrEqual: case FastOp::NGreater:
+        case FastOp::NGreaterOrEqual: case FastOp::NEqual: case FastOp::NNotEqual: case FastOp::NArrayLoad2:
+            reads = { i.b, i.c };
+            write = i.a;
+            return true;
+        case FastOp::NArrayStore1:
+            reads = { i.a, i.b };
+            return true;
+        case FastOp::NArrayStore2:
+            reads = { i.a, i.b, i.c };
+            return true;
+        case FastOp::JumpIfZero:
+            reads = { i.b };
+            return true;
+        case FastOp::JumpIfNotLess: case FastOp::JumpIfNotLessOrEqual: case FastOp::JumpIfNotGreater:
+        case FastOp::JumpIfNotGreaterOrEqual: case FastOp::JumpIfNotEqual: case FastOp::JumpIfEqual:
+            reads = { i.b, i.c };
+            return true;
+        case FastOp::Jump:
+            return true;
+        default:
+            return false;
+        }
+    };
+
+    // If the straight path from the loop head leaves the native code before any branch, every iteration would be
+    // spent switching between the native code and the bytecode
+    vector<int> reads;
+    int write;
+    for (size_t pc = head; pc < backEdge; ++pc)
+    {
+        if (!operands(code[pc], reads, write))
+            return nullptr;
+        if (code[pc].code >= FastOp::Jump)
+            break;
+    }
+
+    // The most used registers stay in XMM registers for the whole loop
+    map<int, int> uses;
+    set<int> written;
+    for (size_t pc = head; pc <= backEdge; ++pc)
+    {
+        if (pc == backEdge && code[pc].code == FastOp::Next)
+        {
+            reads = { var };
+            write = var;
+        }
+        else if (!operands(code[pc], reads, write))
+            continue;
+        for (int reg : reads)
+            ++uses[reg];
+        if (write != INT_MIN)
+        {
+            ++uses[write];
+            written.insert(write);
+        }
+    }
+
+    vector<pair<int, int>> order(uses.begin(), uses.end());
+    stable_sort(order.begin(), order.end(), [](const auto& x, const auto& y) { return x.second > y.second; });
+    map<int, int> allocated;
+    for (size_t i = 0; i < order.size() && i < (size_t)kJitRegisters; ++i)
+        allocated[order[i].first] = 2 + (int)i;
+
+    tX64Code x;
+    const int N = RBX;       // Numeric registers
+    const int context = R14; // tJitContext
+    const int arrayInfo = R13; // tJitArray
+
+    auto load = [&](int xmm, int reg)
+    {
+        auto found = allocated.find(reg);
+        if (found == allocated.end())
+            x.OpMem(0xF3, 0x0F10, false, xmm, N, 4 * reg);
+        else if (found->second != xmm)
+            x.Op(0xF3, 0x0F10, false, xmm, found->second);
+    };
+
+    auto store = [&](int reg, int xmm)
+    {
+        auto found = allocated.find(reg);
+        if (found == allocated.end())
+            x.OpMem(0xF3, 0x0F11, false, xmm, N, 4 * reg);
+        else if (found->second != xmm)
+            x.Op(0xF3, 0x0F10, false, found->second, xmm);
+    };
+
+    // Instruction with an XMM destination and a register operand
+    auto operate = [&](int prefix, int opcode, int xmm, int reg)
+    {
+        auto found = allocated.find(reg);
+        if (found == allocated.end())
+            x.OpMem(prefix, opcode, false, xmm, N, 4 * reg);
+        else
+            x.Op(prefix, opcode, false, xmm, found->second);
+    };
+
+    auto compare = [&](int left, int right)
+    {
+        load(0, left);
+        operate(0, 0x0F2E, 0, right); // ucomiss
+    };
+
+    auto zero = [&](int xmm) { x.Op(0, 0x0F57, false, xmm, xmm); }; // xorps
+
+    // Byte register = (xmm != 0), NaN counts as true same as in C++
+    auto truth = [&](int xmm, int result, int scratch)
+    {
+        zero(1);
+        x.Op(0, 0x0F2E, false, xmm, 1);
+        x.Op(0, 0x0F95, false, 0, result);  // setne
+        x.Op(0, 0x0F9A, false, 0, scratch); // setp
+        x.Op(0, 0x08, false, scratch, result); // or
+    };
+
+    // Byte in AL converted to 0.0 or 1.0
+    auto storeFlag = [&](int reg)
+    {
+        x.Op(0, 0x0FB6, false, RAX, RAX);  // movzx eax, al
+        x.Op(0xF3, 0x0F2A, false, 0, RAX); // cvtsi2ss xmm0, eax
+        store(reg, 0);
+    };
+
+    auto spill = [&]()
+    {
+        for (const auto& a : allocated)
+            if (written.count(a.first))
+                x.OpMem(0xF3, 0x0F11, false, a.second, N, 4 * a.first);
+    };
+
+    auto reload = [&]()
+    {
+        for (const auto& a : allocated)
+            x.OpMem(0xF3, 0x0F10, false, a.second, N, 4 * a.first);
+    };
+
+    auto call = [&](const void* function)
+    {
+        spill();
+        x.Prefix(0, true, 0, RAX, 0xB8); // mov rax, imm64
+        x.Int64((long long)function);
+        x.Op(0, 0xFF, false, 2, RAX);    // call rax
+        reload();
+    };
+
+    map<size_t, int> exits;
+    auto exitTo = [&](size_t pc)
+    {
+        auto found = exits.find(pc);
+        if (found != exits.end())
+            return found->second;
+        int label = x.Label();
+        exits[pc] = label;
+        return label;
+    };
+
+    vector<int> labels;
+    for (size_t pc = head; pc <= backEdge; ++pc)
+        labels.push_back(x.Label());
+    auto target = [&](size_t pc) { return pc >= head && pc <= backEdge ? labels[pc - head] : exitTo(pc); };
+
+    // Back edges inside the native code count down the budget
+    auto backJump = [&](size_t pc)
+    {
+        x.OpMem(0, 0xFF, false, 1, context, (int)offsetof(tJitContext, budget)); // dec
+        x.Jump(CondE, exitTo(pc));
+        x.Jump(target(pc));
+    };
+
+    // Element address in RAX, the index is already checked
+    auto element = [&](const tFastInstruction& i, bool two)
+    {
+        int info = i.d * (int)sizeof(tJitArray);
+        load(0, i.b);
+        x.Op(0xF3, 0x0F2C, false, RAX, 0); // cvttss2si eax, xmm0
+        if (two)
+        {
+            x.OpMem(0, 0x3B, false, RAX, arrayInfo, info + (int)offsetof(tJitArray, rows)); // cmp
+            x.Jump(CondAE, exitTo(&i - code.data()));
+            load(0, i.c);
+            x.Op(0xF3, 0x0F2C, false, RCX, 0);
+            x.OpMem(0, 0x3B, false, RCX, arrayInfo, info + (int)offsetof(tJitArray, columns));
+            x.Jump(CondAE, exitTo(&i - code.data()));
+            x.OpMem(0, 0x0FAF, false, RAX, arrayInfo, info + (int)offsetof(tJitArray, columns)); // imul
+            x.Op(0, 0x01, false, RCX, RAX); // add
+        }
+        else
+        {
+            x.OpMem(0, 0x3B, false, RAX, arrayInfo, info + (int)offsetof(tJitArray, length));
+            x.Jump(CondAE, exitTo(&i - code.data()));
+        }
+        x.Op(0, 0x69, true, RAX, RAX); // imul rax, rax, imm32
+        x.Int32((int)sizeof(tNumber));
+        x.OpMem(0, 0x03, true, RAX, arrayInfo, info + (int)offsetof(tJitArray, data)); // add
+    };
+
+    // Prologue. RBX, R13 and R14 are preserved by the calls in both ABIs, the stack stays aligned for the calls.
+    int epilogue = x.Label();
+    x.Push(RBX);
+    x.Push(R13);
+    x.Push(R14);
+    x.Op(0, 0x83, true, 5, RSP); // sub rsp, 32 (shadow space for Windows)
+    x.Byte(32);
+#ifdef _WIN32
+    x.Op(0, 0x8B, true, context, RCX);
+#else
+    x.Op(0, 0x8B, true, context, RDI);
+#endif
+    x.OpMem(0, 0x8B, true, N, context, (int)offsetof(tJitContext, numbers));
+    x.OpMem(0, 0x8B, true, arrayInfo, context, (int)offsetof(tJitContext, arrays));
+    reload();
+
+    vector<size_t> starts;
+    for (size_t pc = head; pc <= backEdge; ++pc)
+    {
+        const tFastInstruction& i = code[pc];
+        x.Bind(labels[pc - head]);
+        starts.push_back(x.code.size());
+
+        switch (i.code)
+        {
+        case FastOp::NMove:
+            load(0, i.b);
+            store(i.a, 0);
+            break;
+
+        case FastOp::NAdd:
+        case FastOp::NSubtract:
+        case FastOp::NMultiply:
+            load(0, i.b);
+            operate(0xF3, i.code == FastOp::NAdd ? 0x0F58 : i.code == FastOp::NSubtract ? 0x0F5C : 0x0F59, 0, i.c);
+            store(i.a, 0);
+            break;
+
+        case FastOp::NDivide:
+        {
+            // Division by zero is reported by the bytecode
+            int divide = x.Label();
+            load(1, i.c);
+            zero(0);
+            x.Op(0, 0x0F2E, false, 1, 0);
+            x.Jump(CondP, divide);
+            x.Jump(CondE, exitTo(pc));
+            x.Bind(divide);
+            load(0, i.b);
+            x.Op(0xF3, 0x0F5E, false, 0, 1);
+            store(i.a, 0);
+            break;
+        }
+
+        case FastOp::NPower:
+            load(0, i.b);
+            load(1, i.c);
+            call((const void*)JitPower);
+            store(i.a, 0);
+            break;
+
+        case FastOp::NFunction:
+            load(0, i.b);
+            call((const void*)FastFunction(i.d));
+            store(i.a, 0);
+            break;
+
+        case FastOp::NNegate:
+            load(0, i.b);
+            x.Byte(0xB8); // mov eax, sign bit
+            x.Int32(INT_MIN);
+            x.Op(0x66, 0x0F6E, false, 1, RAX); // movd xmm1, eax
+            x.Op(0, 0x0F57, false, 0, 1);
+            store(i.a, 0);
+            break;
+
+        case FastOp::NNot:
+            load(0, i.b);
+            zero(1);
+            x.Op(0, 0x0F2E, false, 0, 1);
+            x.Op(0, 0x0F94, false, 0, RAX); // sete
+            x.Op(0, 0x0F9B, false, 0, RCX); // setnp
+            x.Op(0, 0x20, false, RCX, RAX); // and
+            storeFlag(i.a);
+            break;
+
+        case FastOp::NAnd:
+        case FastOp::NOr:
+            load(0, i.b);
+            truth(0, RAX, RCX);
+            load(0, i.c);
+            truth(0, R8, R9);
+            x.Op(0, i.code == FastOp::NAnd ? 0x20 : 0x08, false, R8, RAX);
+            storeFlag(i.a);
+            break;
+
+        case FastOp::NLess:
+        case FastOp::NLessOrEqual:
+            compare(i.c, i.b);
+            x.Op(0, i.code == FastOp::NLess ? 0x0F97 : 0x0F93, false, 0, RAX); // seta, setae
+            storeFlag(i.a);
+            break;
+
+        case FastOp::NGreater:
+        case FastOp::NGreaterOrEqual:
+            compare(i.b, i.c);
+            x.Op(0, i.code == FastOp::NGreater ? 0x0F97 : 0x0F93, false, 0, RAX);
+            storeFlag(i.a);
+            break;
+
+        case FastOp::NEqual:
+            compare(i.b, i.c);
+            x.Op(0, 0x0F94, false, 0, RAX); // sete
+            x.Op(0, 0x0F9B, false, 0, RCX); // setnp
+            x.Op(0, 0x20, false, RCX, RAX);
+            storeFlag(i.a);
+            break;
+
+        case FastOp::NNotEqual:
+            compare(i.b, i.c);
+            x.Op(0, 0x0F95, false, 0, RAX); // setne
+            x.Op(0, 0x0F9A, false, 0, RCX); // setp
+            x.Op(0, 0x08, false, RCX, RAX);
+            storeFlag(i.a);
+            break;
+
+        case FastOp::NArrayLoad1:
+        case FastOp::NArrayLoad2:
+            element(i, i.code == FastOp::NArrayLoad2);
+            x.OpMem(0xF3, 0x0F10, false, 0, RAX, 0);
+            store(i.a, 0);
+            break;
+
+        case FastOp::NArrayStore1:
+        case FastOp::NArrayStore2:
+            element(i, i.code == FastOp::NArrayStore2);
+            load(0, i.a);
+            x.OpMem(0xF3, 0x0F11, false, 0, RAX, 0);
+            break;
+
+        case FastOp::Jump:
+            if ((size_t)i.a <= pc && (size_t)i.a >= head)
+                backJump(i.a);
+            else
+                x.Jump(target(i.a));
+            break;
+
+        case FastOp::JumpIfZero:
+        {
+            int skip = x.Label();
+            load(0, i.b);
+            zero(1);
+            x.Op(0, 0x0F2E, false, 0, 1);
+            x.Jump(CondP, skip);
+            x.Jump(CondE, target(i.a));
+            x.Bind(skip);
+            break;
+        }
+
+        // Unordered comparisons (NaN) have CF, ZF and PF set, so the "not" jumps are taken for them
+        case FastOp::JumpIfNotLess: compare(i.c, i.b); x.Jump(CondBE, target(i.a)); break;
+        case FastOp::JumpIfNotLessOrEqual: compare(i.c, i.b); x.Jump(CondB, target(i.a)); break;
+        case FastOp::JumpIfNotGreater: compare(i.b, i.c); x.Jump(CondBE, target(i.a)); break;
+        case FastOp::JumpIfNotGreaterOrEqual: compare(i.b, i.c); x.Jump(CondB, target(i.a)); break;
+
+        case FastOp::JumpIfNotEqual:
+            compare(i.b, i.c);
+            x.Jump(CondNE, target(i.a));
+            x.Jump(CondP, target(i.a));
+            break;
+
+        case FastOp::JumpIfEqual:
+        {
+            int skip = x.Label();
+            compare(i.b, i.c);
+            x.Jump(CondP, skip);
+            x.Jump(CondE, target(i.a));
+            x.Bind(skip);
+            break;
+        }
+
+        case FastOp::Next:
+            if (pc == backEdge)
+            {
+                // Same as the bytecode: the variable is updated, then (value - limit) * step <= 0 continues the loop
+                int done = x.Label();
+                load(0, var);
+                x.OpMem(0xF3, 0x0F58, false, 0, context, (int)offsetof(tJitContext, step));
+                store(var, 0);
+                x.OpMem(0xF3, 0x0F5C, false, 0, context, (int)offsetof(tJitContext, limit));
+                x.OpMem(0xF3, 0x0F59, false, 0, context, (int)offsetof(tJitContext, step));
+                zero(1);
+                x.Op(0, 0x0F2E, false, 0, 1);
+                x.Jump(CondP, done);
+                x.Jump(CondA, done);
+                backJump(head);
+                x.Bind(done);
+                x.OpMem(0, 0xC7, false, 0, context, (int)offsetof(tJitContext, loopDone)); // mov dword
+                x.Int32(1);
+                x.Jump(exitTo(pc + 1));
+                break;
+            }
+            x.Jump(exitTo(pc));
+            break;
+
+        default:
+            x.Jump(exitTo(pc));
+            break;
+        }
+    }
+    starts.push_back(x.code.size());
+
+    // Exits store the registers and return the instruction to continue from
+    for (const auto& e : exits)
+    {
+        x.Bind(e.second);
+        spill();
+        x.Byte(0xB8); // mov eax, imm32
+        x.Int32((int)e.first);
+        x.Jump(epilogue);
+    }
+
+    x.Bind(epilogue);
+    x.Op(0, 0x83, true, 0, RSP); // add rsp, 32
+    x.Byte(32);
+    x.Pop(R14);
+    x.Pop(R13);
+    x.Pop(RBX);
+    x.Byte(0xC3); // ret
+    x.Resolve();
+
+    // Executable memory is never writable at the same time
+#ifdef _WIN32
+    void* memory = VirtualAlloc(nullptr, x.code.size(), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (memory == nullptr)
+        return nullptr;
+    memcpy(memory, x.code.data(), x.code.size());
+    DWORD oldProtect;
+    VirtualProtect(memory, x.code.size(), PAGE_EXECUTE_READ, &oldProtect);
+    FlushInstructionCache(GetCurrentProcess(), memory, x.code.size());
+#else
+    void* memory = mmap(nullptr, x.code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return nullptr;
+    memcpy(memory, x.code.data(), x.code.size());
+    if (mprotect(memory, x.code.size(), PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, x.code.size());
+        return nullptr;
+    }
+
+    // perf map, one symbol per BASIC line in the loop
+    char mapName[64];
+    sprintf(mapName, "/tmp/perf-%d.map", (int)getpid());
+    FILE* perfMap = fopen(mapName, "a");
+    if (perfMap != nullptr)
+    {
+        size_t first = head;
+        for (size_t pc = head + 1; pc <= backEdge + 1; ++pc)
+        {
+            if (pc <= backEdge && fastProgram.lines[pc] == fastProgram.lines[first])
+                continue;
+            size_t from = first == head ? 0 : starts[first - head]; // The first line gets the prologue too
+            fprintf(perfMap, "%llx %llx BASIC line %d\n", (unsigned long long)((char*)memory + from), (unsigned long long)(starts[pc - head] - from),
+                programLines[fastProgram.lines[first]].lineNum);
+            first = pc;
+        }
+        fprintf(perfMap, "%llx %llx BASIC line %d exits\n", (unsigned long long)((char*)memory + starts.back()), (unsigned long long)(x.code.size() - starts.back()),
+            programLines[fastProgram.lines[head]].lineNum);
+        fclose(perfMap);
+    }
+#endif
+
+    jitMemory.push_back({ memory, x.code.size() });
+    return (tJitFunction)memory;
+}
+
+void BasicMachine::JitRelease()
+{
+    for (const auto& block : jitMemory)
+#ifdef _WIN32
+        VirtualFree(block.first, 0, MEM_RELEASE);
+#else
+        munmap(block.first, block.second);
+#endif
+    jitMemory.clear();
+}
+
+#else
+
+BasicMachine::tJitFunction BasicMachine::CompileJit(size_t backEdge, size_t head, int var)
+{
+    return nullptr;
+}
+
+void BasicMachine::JitRelease()
+{
+}
+
+#endif
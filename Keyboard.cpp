@@ -0,0 +1,158 @@
+#include <signal.h>
+
+#include "Basic.h"
+
+#include <chrono>
+
+#ifdef _WIN32
+#include <conio.h>
+#else
+#include <termios.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// Keyboard layer. While the program runs, a background thread takes the keys as they are typed: ESC (and Ctrl-C)
+// raise the break flag, everything else goes to a small ring buffer for INKEY$. The machine only looks at the flag
+// before each statement. Reading a line (the command line or INPUT) pauses the thread, and on POSIX systems the
+// terminal goes back to the normal line mode for that time.
+
+atomic<bool> BasicMachine::keyboardBreak{ false };
+
+enum { kKeyboardRunning, kKeyboardPausing, kKeyboardPaused, kKeyboardStopping };
+
+#ifndef _WIN32
+static termios savedTerminal;
+#endif
+
+static void BreakHandler(int)
+{
+    BasicMachine::RequestBreak();
+}
+
+void BasicMachine::RequestBreak()
+{
+    keyboardBreak.store(true, memory_order_relaxed);
+}
+
+void BasicMachine::StartKeyboard()
+{
+    keyHead = 0;
+    keyTail = 0;
+    keyboardBreak = false;
+
+#ifdef _WIN32
+    keyboardState = kKeyboardPaused;
+#else
+    // Keys cannot be taken from a file or a pipe, those have the program input
+    if (!isatty(STDIN_FILENO))
+        return;
+    tcgetattr(STDIN_FILENO, &savedTerminal);
+    keyboardState = kKeyboardPaused;
+#endif
+
+    keyboardThread = thread([this]()
+    {
+        for (;;)
+        {
+            int state = keyboardState.load();
+            if (state == kKeyboardStopping)
+                return;
+            if (state != kKeyboardRunning)
+            {
+                if (state == kKeyboardPausing)
+                    keyboardState.compare_exchange_strong(state, kKeyboardPaused);
+                this_thread::sleep_for(chrono::milliseconds(5));
+                continue;
+            }
+
+            char key = 0;
+#ifdef _WIN32
+            if (_kbhit())
+                key = (char)_getch();
+            else
+                this_thread::sleep_for(chrono::milliseconds(10));
+#else
+            pollfd input{ STDIN_FILENO, POLLIN, 0 };
+            if (poll(&input, 1, 10) > 0 && keyboardState.load() == kKeyboardRunning && read(STDIN_FILENO, &key, 1) != 1)
+                key = 0;
+#endif
+            if (key == 27)
+                RequestBreak();
+            else if (key != 0 && keyHead - keyTail.load(memory_order_acquire) < sizeof(keyBuffer))
+            {
+                keyBuffer[keyHead % sizeof(keyBuffer)] = key;
+                keyHead.store(keyHead + 1, memory_order_release);
+            }
+        }
+    });
+
+    ResumeKeyboard();
+}
+
+void BasicMachine::StopKeyboard()
+{
+    if (!keyboardThread.joinable())
+        return;
+    PauseKeyboard();
+    keyboardState = kKeyboardStopping;
+    keyboardThread.join();
+}
+
+void BasicMachine::PauseKeyboard()
+{
+    if (!keyboardThread.joinable())
+        return;
+
+    int state = kKeyboardRunning;
+    if (keyboardState.compare_exchange_strong(state, kKeyboardPausing))
+    {
+        while (keyboardState.load() == kKeyboardPausing)
+            this_thread::yield();
+        signal(SIGINT, SIG_DFL);
+#ifndef _WIN32
+        tcsetattr(STDIN_FILENO, TCSANOW, &savedTerminal);
+#endif
+    }
+
+    // Keys typed while the program was running should not get into the line
+    keyTail.store(keyHead.load(memory_order_acquire), memory_order_release);
+    keyboardBreak = false;
+}
+
+void BasicMachine::ResumeKeyboard()
+{
+    if (!keyboardThread.joinable() || keyboardState.load() != kKeyboardPaused)
+        return;
+
+#ifndef _WIN32
+    // Keys come one at a time and are not echoed, Ctrl-C still sends the signal
+    termios raw = savedTerminal;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+#endif
+    signal(SIGINT, BreakHandler);
+    keyboardState = kKeyboardRunning;
+}
+
+// Called before each statement, returns 27 if the program should stop
+char BasicMachine::TestKeyboard()
+{
+    if (!keyboardBreak.load(memory_order_relaxed))
+        return 0;
+    keyboardBreak.store(false, memory_order_relaxed);
+    return executionPointer.lineNum == kCommandLine ? 0 : 27;
+}
+
+// Next key from the buffer for INKEY$, 0 if there is none
+char BasicMachine::ReadKey()
+{
+    unsigned tail = keyTail.load(memory_order_relaxed);
+    if (tail == keyHead.load(memory_order_acquire))
+        return 0;
+    char key = keyBuffer[tail % sizeof(keyBuffer)];
+    keyTail.store(tail + 1, memory_order_release);
+    return key;
+}
@@ -0,0 +1,544 @@
+#include "Basic.h"
+
+#include <algorithm>
+
+// MAT statements of Dartmouth BASIC. An array is a matrix of its elements from index 1, row and column 0 are not
+// used, and a one dimensional array is a column vector (a row one on the left side of a multiplication). The whole
+// statement works on the number buffers of the arrays: the result is computed into a separate buffer, so the target
+// may be one of the operands, and then the target is redimensioned to the shape of the result when it has another
+// one. The kernels run along the contiguous rows, so the compiler vectorizes them, and the multiplication goes by
+// blocks small enough to stay in the cache.
+//
+//   MAT READ A[(dimensions)][,...]
+//   MAT PRINT A[,|;][B...]
+//   MAT A=ZER|CON|IDN[(dimensions)]
+//   MAT A=B, MAT A=B+C, MAT A=B-C, MAT A=B*C, MAT A=TRN(B), MAT A=INV(B), MAT A=(expression)*B
+
+static const int kMatrixBlock = 64;
+
+static inline void MatrixCopy(tNumber* y, const tNumber* x, int n)
+{
+    for (int i = 0; i < n; ++i)
+        y[i] = x[i];
+}
+
+static inline void MatrixAdd(tNumber* y, const tNumber* a, const tNumber* b, int n)
+{
+    for (int i = 0; i < n; ++i)
+        y[i] = a[i] + b[i];
+}
+
+static inline void MatrixSubtract(tNumber* y, const tNumber* a, const tNumber* b, int n)
+{
+    for (int i = 0; i < n; ++i)
+        y[i] = a[i] - b[i];
+}
+
+template <class T> static inline void MatrixScale(T* y, const T* x, T k, int n)
+{
+    for (int i = 0; i < n; ++i)
+        y[i] = k * x[i];
+}
+
+// y += k*x
+template <class T> static inline void MatrixAddScaled(T* y, const T* x, T k, int n)
+{
+    for (int i = 0; i < n; ++i)
+        y[i] += k * x[i];
+}
+
+// c = a*b, where a is n by m, b is m by p and c is n by p, dense and zeroed. A block of b is used for all the rows of a
+// before moving to the next one
+static void MatrixMultiply(const tNumber* a, int aStride, const tNumber* b, int bStride, tNumber* c, int n, int m, int p)
+{
+    for (int kk = 0; kk < m; kk += kMatrixBlock)
+    {
+        int kEnd = min(kk + kMatrixBlock, m);
+        for (int jj = 0; jj < p; jj += kMatrixBlock)
+        {
+            int width = min(jj + kMatrixBlock, p) - jj;
+            for (int i = 0; i < n; ++i)
+                for (int k = kk; k < kEnd; ++k)
+                    MatrixAddScaled(c + i * p + jj, b + k * bStride + jj, a[i * aStride + k], width);
+        }
+    }
+}
+
+// Gauss-Jordan elimination with partial pivoting, a (dense, n by n) is destroyed and the inverse goes to inverse.
+// Done in doubles whatever the number type, the errors add up quickly. False if the matrix is singular
+static bool MatrixInvert(vector<double>& a, vector<double>& inverse, int n)
+{
+    inverse.assign((size_t)n * n, 0.0);
+    for (int i = 0; i < n; ++i)
+        inverse[i * n + i] = 1;
+
+    for (int k = 0; k < n; ++k)
+    {
+        int pivot = k;
+        for (int r = k + 1; r < n; ++r)
+            if (fabs(a[r * n + k]) > fabs(a[pivot * n + k]))
+                pivot = r;
+        if (a[pivot * n + k] == 0)
+            return false;
+        if (pivot != k)
+        {
+            swap_ranges(a.begin() + k * n, a.begin() + (k + 1) * n, a.begin() + pivot * n);
+            swap_ranges(inverse.begin() + k * n, inverse.begin() + (k + 1) * n, inverse.begin() + pivot * n);
+        }
+
+        double scale = 1 / a[k * n + k];
+        MatrixScale(&a[k * n], &a[k * n], scale, n);
+        MatrixScale(&inverse[k * n], &inverse[k * n], scale, n);
+        for (int r = 0; r < n; ++r)
+        {
+            double f = a[r * n + k];
+            if (r == k || f == 0)
+                continue;
+            MatrixAddScaled(&a[r * n], &a[k * n], -f, n);
+            MatrixAddScaled(&inverse[r * n], &inverse[k * n], -f, n);
+        }
+    }
+    return true;
+}
+
+// MAT READ arrays, MAT PRINT arrays, or MAT array=matrix expression
+bool BasicMachine::ParseMat(tStatement& result, const char*& ptr)
+{
+    IgnoreSpaces(ptr);
+    bool valid = true;
+    if (Match(ptr, "READ"))
+    {
+        result.push_back((byte)MatForm::Read);
+        do
+        {
+            valid = TryParseArrayName(result, ptr);
+            if (valid && IsNextSymbolDrop(ptr, '('))
+                valid = TryParseExpression(result, ptr);
+            else
+                result.push_back((byte)TokenType::ttNone);
+        } while (valid && IsNextSymbolDrop(ptr, ','));
+        return valid;
+    }
+
+    if (Match(ptr, "PRINT"))
+    {
+        result.push_back((byte)MatForm::Print);
+        do
+        {
+            valid = TryParseArrayName(result, ptr);
+            char separator = 0;
+            if (IsNextSymbolDrop(ptr, ','))
+                separator = ',';
+            else if (IsNextSymbolDrop(ptr, ';'))
+                separator = ';';
+            result.push_back((byte)separator);
+
+            // A separator may end the statement as well
+            IgnoreSpaces(ptr);
+            if (separator == 0 || !isalpha(*ptr) || TestMatch(ptr, "ELSE"))
+                break;
+        } while (valid);
+        return valid;
+    }
+
+    size_t form = result.size();
+    result.push_back((byte)MatForm::Copy);
+    if (!TryParseArrayName(result, ptr) || !IsNextSymbolDrop(ptr, '='))
+        return false;
+
+    IgnoreSpaces(ptr);
+    MatForm fill = Match(ptr, "ZER") ? MatForm::Zer : Match(ptr, "CON") ? MatForm::Con : Match(ptr, "IDN") ? MatForm::Idn : MatForm::Copy;
+    if (fill != MatForm::Copy)
+    {
+        result[form] = (byte)fill;
+        if (IsNextSymbolDrop(ptr, '('))
+            return TryParseExpression(result, ptr);
+        result.push_back((byte)TokenType::ttNone);
+        return true;
+    }
+
+    MatForm function = Match(ptr, "TRN") ? MatForm::Transpose : Match(ptr, "INV") ? MatForm::Inverse : MatForm::Copy;
+    if (function != MatForm::Copy)
+    {
+        result[form] = (byte)function;
+        return IsNextSymbolDrop(ptr, '(') && TryParseArrayName(result, ptr) && IsNextSymbolDrop(ptr, ')');
+    }
+
+    if (IsNextSymbolDrop(ptr, '('))
+    {
+        result[form] = (byte)MatForm::Scale;
+        return TryParseExpression(result, ptr) && IsNextSymbolDrop(ptr, '*') && TryParseArrayName(result, ptr);
+    }
+
+    if (!TryParseArrayName(result, ptr))
+        return false;
+    if (IsNextSymbolDrop(ptr, '+'))
+        result[form] = (byte)MatForm::Add;
+    else if (IsNextSymbolDrop(ptr, '-'))
+        result[form] = (byte)MatForm::Subtract;
+    else if (IsNextSymbolDrop(ptr, '*'))
+        result[form] = (byte)MatForm::Multiply;
+    else
+        return true;
+    return TryParseArrayName(result, ptr);
+}
+
+void BasicMachine::ExecuteMat(const byte* parms)
+{
+    int len = DecodeParmsLength(parms);
+    const byte* limit = parms + len;
+    MatForm form = (MatForm)*parms++;
+    if (form == MatForm::Read)
+    {
+        MatRead(parms, limit);
+        return;
+    }
+    if (form == MatForm::Print)
+    {
+        MatPrint(parms, limit);
+        return;
+    }
+
+    int target = DecodeArray(parms);
+    tMatrix a, b;
+    int rows = 0, columns = 0;
+    vector<tNumber> values;
+    switch (form)
+    {
+    case MatForm::Zer:
+    case MatForm::Con:
+    case MatForm::Idn:
+        if (GetNextTokenType(parms) == TokenType::ttExpression)
+        {
+            if (!ArrayCreate((byte)target, EvaluateExpression(parms)))
+            {
+                ErrorCondition("Bad matrix dimensions");
+                return;
+            }
+        }
+        else
+            ++parms;
+        if (!MatrixOf(target, a))
+            return;
+        if (form == MatForm::Idn && a.rows != a.columns)
+        {
+            ErrorCondition("Bad matrix dimensions");
+            return;
+        }
+        for (int r = 0; r < a.rows; ++r)
+            for (int c = 0; c < a.columns; ++c)
+                a.data[r * a.stride + c] = form == MatForm::Con || (form == MatForm::Idn && r == c) ? tNumber(1.0) : tNumber(0.0);
+        return;
+
+    case MatForm::Copy:
+    case MatForm::Transpose:
+        if (!MatrixOf(DecodeArray(parms), a))
+            return;
+        rows = form == MatForm::Copy ? a.rows : a.columns;
+        columns = form == MatForm::Copy ? a.columns : a.rows;
+        values.resize((size_t)rows * columns);
+        for (int r = 0; r < a.rows; ++r)
+        {
+            if (form == MatForm::Copy)
+                MatrixCopy(&values[r * columns], a.data + r * a.stride, a.columns);
+            else
+                for (int c = 0; c < a.columns; ++c)
+                    values[c * columns + r] = a.data[r * a.stride + c];
+        }
+        break;
+
+    case MatForm::Inverse:
+    {
+        if (!MatrixOf(DecodeArray(parms), a))
+            return;
+        if (a.rows != a.columns)
+        {
+            ErrorCondition("Bad matrix dimensions");
+            return;
+        }
+        rows = columns = a.rows;
+        vector<double> work((size_t)rows * columns), inverse;
+        for (int r = 0; r < rows; ++r)
+            for (int c = 0; c < columns; ++c)
+                work[r * columns + c] = a.data[r * a.stride + c];
+        if (!MatrixInvert(work, inverse, rows))
+        {
+            ErrorCondition("Singular matrix");
+            return;
+        }
+        values.assign(inverse.begin(), inverse.end());
+        break;
+    }
+
+    case MatForm::Scale:
+    {
+        auto k = EvaluateExpression(parms);
+        if (inErrorCondition)
+            return;
+        if (k.size() != 1 || !k[0].IsNumeric())
+        {
+            ErrorCondition("Bad value type");
+            return;
+        }
+        if (!MatrixOf(DecodeArray(parms), a))
+            return;
+        rows = a.rows;
+        columns = a.columns;
+        values.resize((size_t)rows * columns);
+        for (int r = 0; r < rows; ++r)
+            MatrixScale(&values[r * columns], a.data + r * a.stride, k[0].Number(), columns);
+        break;
+    }
+
+    default:
+        if (!MatrixOf(DecodeArray(parms), a) || !MatrixOf(DecodeArray(parms), b))
+            return;
+        if (form == MatForm::Multiply)
+        {
+            // A vector on the left is a row
+            if (a.isVector)
+            {
+                a.columns = a.rows;
+                a.rows = 1;
+            }
+            if (a.columns != b.rows)
+            {
+                ErrorCondition("Bad matrix dimensions");
+                return;
+            }
+            rows = a.rows;
+            columns = b.columns;
+            values.assign((size_t)rows * columns, tNumber(0.0));
+            MatrixMultiply(a.data, a.stride, b.data, b.stride, values.data(), rows, a.columns, columns);
+            break;
+        }
+
+        if (a.rows != b.rows || a.columns != b.columns)
+        {
+            ErrorCondition("Bad matrix dimensions");
+            return;
+        }
+        rows = a.rows;
+        columns = a.columns;
+        values.resize((size_t)rows * columns);
+        for (int r = 0; r < rows; ++r)
+        {
+            if (form == MatForm::Add)
+                MatrixAdd(&values[r * columns], a.data + r * a.stride, b.data + r * b.stride, columns);
+            else
+                MatrixSubtract(&values[r * columns], a.data + r * a.stride, b.data + r * b.stride, columns);
+        }
+        break;
+    }
+
+    StoreMatrix(target, rows, columns, values);
+}
+
+string BasicMachine::ListMat(const byte* parms) const
+{
+    string result{ ParmsToName(parms) };
+    result += ' ';
+    int len = DecodeParmsLength(parms);
+    const byte* limit = parms + len;
+    MatForm form = (MatForm)*parms++;
+    if (form == MatForm::Read || form == MatForm::Print)
+    {
+        result += form == MatForm::Read ? "READ " : "PRINT ";
+        int count = 0;
+        while (parms < limit)
+        {
+            if (form == MatForm::Read && count++)
+                result += ',';
+            DecodeArray(result, parms);
+            if (form == MatForm::Print)
+            {
+                if (*parms != (byte)0)
+                    result += (char)*parms;
+                ++parms;
+            }
+            else if (GetNextTokenType(parms) == TokenType::ttExpression)
+            {
+                result += '(';
+                DecodeExpression(result, parms);
+                result += ')';
+            }
+            else
+                ++parms;
+        }
+        return result;
+    }
+
+    DecodeArray(result, parms);
+    result += '=';
+    switch (form)
+    {
+    case MatForm::Zer:
+    case MatForm::Con:
+    case MatForm::Idn:
+        result += form == MatForm::Zer ? "ZER" : form == MatForm::Con ? "CON" : "IDN";
+        if (GetNextTokenType(parms) == TokenType::ttExpression)
+        {
+            result += '(';
+            DecodeExpression(result, parms);
+            result += ')';
+        }
+        break;
+    case MatForm::Transpose:
+    case MatForm::Inverse:
+        result += form == MatForm::Transpose ? "TRN(" : "INV(";
+        DecodeArray(result, parms);
+        result += ')';
+        break;
+    case MatForm::Scale:
+        result += '(';
+        DecodeExpression(result, parms);
+        result += ")*";
+        DecodeArray(result, parms);
+        break;
+    default:
+        DecodeArray(result, parms);
+        if (form != MatForm::Copy)
+        {
+            result += form == MatForm::Add ? '+' : form == MatForm::Subtract ? '-' : '*';
+            DecodeArray(result, parms);
+        }
+        break;
+    }
+    return result;
+}
+
+// The matrix of a number array, false after an error
+bool BasicMachine::MatrixOf(int ar, tMatrix& m)
+{
+    tArrayInfo& ai = arrays[ar];
+    if (ai.name.back() == '$' || ai.name.back() == '%')
+    {
+        ErrorCondition("Bad value type");
+        return false;
+    }
+    if (ai.dimensions.size() > 2)
+    {
+        ErrorCondition("Bad matrix dimensions");
+        return false;
+    }
+
+    m.isVector = ai.dimensions.size() == 1;
+    m.rows = ai.dimensions[0] - 1;
+    m.columns = m.isVector ? 1 : ai.dimensions[1] - 1;
+    m.stride = m.isVector ? 1 : ai.strides[0];
+    m.data = ai.numbers.data() + (m.isVector ? 1 : m.stride + 1);
+    return true;
+}
+
+// The target takes the shape of the result, a vector stays one if the result is a row or a column
+void BasicMachine::StoreMatrix(int ar, int rows, int columns, const vector<tNumber>& values)
+{
+    tArrayInfo& ai = arrays[ar];
+    bool isVector = ai.dimensions.size() == 1 && (rows == 1 || columns == 1);
+    bool same = isVector ? ai.dimensions[0] == rows * columns + 1 :
+        ai.dimensions.size() == 2 && ai.dimensions[0] == rows + 1 && ai.dimensions[1] == columns + 1;
+    if (!same)
+    {
+        tExpressionValue dims;
+        if (isVector)
+            dims.push_back((tNumber)(rows * columns));
+        else
+        {
+            dims.push_back((tNumber)rows);
+            dims.push_back(tSeparator(','));
+            dims.push_back((tNumber)columns);
+        }
+        if (!ArrayCreate((byte)ar, dims))
+        {
+            ErrorCondition("Bad matrix dimensions");
+            return;
+        }
+    }
+
+    tMatrix m;
+    MatrixOf(ar, m);
+    if (isVector)
+        MatrixCopy(m.data, values.data(), rows * columns);
+    else
+        for (int r = 0; r < rows; ++r)
+            MatrixCopy(m.data + r * m.stride, &values[r * columns], columns);
+}
+
+// Elements from index 1 in the order of the rows, any type
+void BasicMachine::MatRead(const byte* parms, const byte* limit)
+{
+    while (!inErrorCondition && parms < limit)
+    {
+        int ar = DecodeArray(parms);
+        if (GetNextTokenType(parms) == TokenType::ttExpression)
+        {
+            if (!ArrayCreate((byte)ar, EvaluateExpression(parms)))
+            {
+                ErrorCondition("Bad matrix dimensions");
+                return;
+            }
+        }
+        else
+            ++parms;
+
+        tArrayInfo& ai = arrays[ar];
+        if (ai.dimensions.size() > 2)
+        {
+            ErrorCondition("Bad matrix dimensions");
+            return;
+        }
+        int rows = ai.dimensions[0] - 1;
+        int columns = ai.dimensions.size() == 1 ? 1 : ai.dimensions[1] - 1;
+        int stride = ai.dimensions.size() == 1 ? 1 : ai.strides[0];
+        int first = ai.dimensions.size() == 1 ? 1 : stride + 1;
+        tValue val;
+        for (int r = 0; r < rows; ++r)
+            for (int c = 0; c < columns; ++c)
+            {
+                if (!GetNextDataItem(val))
+                    return;
+                if (!StoreArrayElement(ai, first + r * stride + c, val))
+                {
+                    ErrorCondition("Bad data type");
+                    return;
+                }
+            }
+    }
+}
+
+// Each row on its own line (a vector is a column), the separator after the array spaces the elements as in PRINT,
+// and an empty line follows the matrix
+void BasicMachine::MatPrint(const byte* parms, const byte* limit)
+{
+    while (!inErrorCondition && parms < limit)
+    {
+        int ar = DecodeArray(parms);
+        char separator = (char)*parms++;
+        const tArrayInfo& ai = arrays[ar];
+        if (ai.dimensions.size() > 2)
+        {
+            ErrorCondition("Bad matrix dimensions");
+            return;
+        }
+        int rows = ai.dimensions[0] - 1;
+        int columns = ai.dimensions.size() == 1 ? 1 : ai.dimensions[1] - 1;
+        int stride = ai.dimensions.size() == 1 ? 1 : ai.strides[0];
+        int first = ai.dimensions.size() == 1 ? 1 : stride + 1;
+
+        tExpressionValue row;
+        for (int r = 0; r < rows; ++r)
+        {
+            row.clear();
+            for (int c = 0; c < columns; ++c)
+            {
+                if (c > 0)
+                    row.push_back(tSeparator(separator == ';' ? ';' : ','));
+                row.push_back(ArrayElement(ai, first + r * stride + c));
+            }
+            PrintValues(row);
+            printPos = 0;
+            OutputLine();
+        }
+        OutputLine();
+    }
+}
@@ -0,0 +1,187 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "Basic.h"
+
+#include <chrono>
+
+#ifdef _WIN32
+#include <io.h>
+#define isatty _isatty
+#define fileno _fileno
+#else
+#include <unistd.h>
+#endif
+
+// Output layer. Everything the machine prints is collected in one buffer and written out in large pieces, when the
+// buffer fills up and at the points selected by the flush policy. Optionally, the writes are done by a separate
+// thread, taking the text from a ring buffer, so the program does not wait for the console at all.
+
+static const size_t kOutputBufferSize = 65536;
+static const size_t kOutputRingSize = 1 << 20;
+
+void BasicMachine::InitOutput()
+{
+    outputBuffer.reserve(kOutputBufferSize);
+
+    outputFile = stdout;
+
+    // A terminal shows each line as it is printed, a file or a pipe only gets full buffers
+    outputFlush = isatty(fileno(stdout)) ? kFlushLine | kFlushInput : kFlushInput;
+}
+
+void BasicMachine::SetOutputPolicy(int flush, bool async)
+{
+    FlushOutput(true);
+    outputFlush = flush;
+
+    if (async == outputThread.joinable())
+        return;
+
+    if (!async)
+    {
+        outputStop = true;
+        outputThread.join();
+        return;
+    }
+
+    outputRing.resize(kOutputRingSize);
+    outputHead = 0;
+    outputTail = 0;
+    outputStop = false;
+    outputThread = thread([this]()
+    {
+        for (;;)
+        {
+            size_t tail = outputTail.load(memory_order_relaxed);
+            size_t head = outputHead.load(memory_order_acquire);
+            if (head == tail)
+            {
+                if (outputStop.load())
+                    return;
+                this_thread::sleep_for(chrono::milliseconds(1));
+                continue;
+            }
+
+            // Only the contiguous part, the rest goes on the next pass
+            FILE* file = outputFile.load(memory_order_acquire);
+            size_t offset = tail % kOutputRingSize;
+            size_t length = min(head - tail, kOutputRingSize - offset);
+            fwrite(&outputRing[offset], 1, length, file);
+            fflush(file);
+            outputTail.store(tail + length, memory_order_release);
+        }
+    });
+}
+
+// Output of the batch mode may go elsewhere, the benchmark discards it. The text so far is written to the old file
+// and the writer thread is idle when the file changes
+void BasicMachine::SetOutputFile(FILE* file)
+{
+    FlushOutput(true);
+    outputFile.store(file, memory_order_release);
+}
+
+void BasicMachine::StopOutput()
+{
+    if (outputThread.joinable())
+        SetOutputPolicy(outputFlush, false);
+    else
+        FlushOutput(true);
+}
+
+// Hands the buffered text to the writer thread or writes it directly. With wait, returns only when the text is
+// actually out (before reading the input, for one)
+void BasicMachine::FlushOutput(bool wait)
+{
+    if (!outputThread.joinable())
+    {
+        FILE* file = outputFile.load(memory_order_relaxed);
+        if (!outputBuffer.empty())
+            fwrite(outputBuffer.data(), 1, outputBuffer.size(), file);
+        outputBuffer.clear();
+        fflush(file);
+        return;
+    }
+
+    size_t head = outputHead.load(memory_order_relaxed);
+    for (size_t done = 0; done < outputBuffer.size();)
+    {
+        size_t space = kOutputRingSize - (head - outputTail.load(memory_order_acquire));
+        if (space == 0)
+        {
+            this_thread::yield();
+            continue;
+        }
+
+        size_t offset = head % kOutputRingSize;
+        size_t length = min(min(space, outputBuffer.size() - done), kOutputRingSize - offset);
+        memcpy(&outputRing[offset], outputBuffer.data() + done, length);
+        done += length;
+        head += length;
+        outputHead.store(head, memory_order_release);
+    }
+    outputBuffer.clear();
+
+    if (wait)
+    {
+        while (outputTail.load(memory_order_acquire) != head)
+            this_thread::yield();
+    }
+}
+
+void BasicMachine::Output(const char* text, size_t length)
+{
+    outputBuffer.append(text, length);
+    if (outputBuffer.size() >= kOutputBufferSize)
+        FlushOutput();
+}
+
+void BasicMachine::Output(const char* text)
+{
+    Output(text, strlen(text));
+}
+
+void BasicMachine::Output(const string& text)
+{
+    Output(text.data(), text.size());
+}
+
+void BasicMachine::Output(char c)
+{
+    outputBuffer += c;
+    if (outputBuffer.size() >= kOutputBufferSize)
+        FlushOutput();
+}
+
+// Same as puts
+void BasicMachine::OutputLine(const char* text)
+{
+    Output(text);
+    outputBuffer += '\n';
+    if ((outputFlush & kFlushLine) || outputBuffer.size() >= kOutputBufferSize)
+        FlushOutput();
+}
+
+void BasicMachine::OutputFormat(const char* format, ...)
+{
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length < (int)sizeof(buffer))
+    {
+        if (length > 0)
+            Output(buffer, length);
+        return;
+    }
+
+    string longer(length + 1, 0);
+    va_start(args, format);
+    vsnprintf(&longer[0], longer.size(), format, args);
+    va_end(args);
+    Output(longer.data(), length);
+}
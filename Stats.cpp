@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "Basic.h"
+
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Interpreter statistics. The counters are plain increments in the places they count. The heap is counted by
+// replacing the global operator new and delete, which takes over the allocator of the whole process, so it is only
+// done when BASIC_HEAP_STATS is defined (build.bat and the benchmarks); a host program linking the machine keeps its
+// own allocator and the heap counts stay zero. The heap counters are shared by all threads, the keyboard and output
+// threads allocate too.
+
+uint64_t BasicMachine::expressionAllocations = 0;
+
+static atomic<uint64_t> heapAllocations{ 0 }, heapBytes{ 0 };
+
+#ifdef BASIC_HEAP_STATS
+// Every form is replaced, so each delete gets memory from its own new
+static void* CountedAlloc(size_t size, size_t alignment)
+{
+    heapAllocations.fetch_add(1, memory_order_relaxed);
+    heapBytes.fetch_add(size, memory_order_relaxed);
+    if (size == 0)
+        size = 1;
+    if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        return malloc(size);
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+}
+
+static void CountedFree(void* p, size_t alignment)
+{
+#ifdef _WIN32
+    if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+    {
+        _aligned_free(p);
+        return;
+    }
+#endif
+    free(p);
+}
+
+static void* CountedNew(size_t size, size_t alignment)
+{
+    if (void* p = CountedAlloc(size, alignment))
+        return p;
+    throw bad_alloc();
+}
+
+void* operator new(size_t size) { return CountedNew(size, 0); }
+void* operator new[](size_t size) { return CountedNew(size, 0); }
+void* operator new(size_t size, const nothrow_t&) noexcept { return CountedAlloc(size, 0); }
+void* operator new[](size_t size, const nothrow_t&) noexcept { return CountedAlloc(size, 0); }
+void* operator new(size_t size, align_val_t alignment) { return CountedNew(size, (size_t)alignment); }
+void* operator new[](size_t size, align_val_t alignment) { return CountedNew(size, (size_t)alignment); }
+void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept { return CountedAlloc(size, (size_t)alignment); }
+void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept { return CountedAlloc(size, (size_t)alignment); }
+
+void operator delete(void* p) noexcept { CountedFree(p, 0); }
+void operator delete[](void* p) noexcept { CountedFree(p, 0); }
+void operator delete(void* p, size_t) noexcept { CountedFree(p, 0); }
+void operator delete[](void* p, size_t) noexcept { CountedFree(p, 0); }
+void operator delete(void* p, const nothrow_t&) noexcept { CountedFree(p, 0); }
+void operator delete[](void* p, const nothrow_t&) noexcept { CountedFree(p, 0); }
+void operator delete(void* p, align_val_t alignment) noexcept { CountedFree(p, (size_t)alignment); }
+void operator delete[](void* p, align_val_t alignment) noexcept { CountedFree(p, (size_t)alignment); }
+void operator delete(void* p, size_t, align_val_t alignment) noexcept { CountedFree(p, (size_t)alignment); }
+void operator delete[](void* p, size_t, align_val_t alignment) noexcept { CountedFree(p, (size_t)alignment); }
+void operator delete(void* p, align_val_t alignment, const nothrow_t&) noexcept { CountedFree(p, (size_t)alignment); }
+void operator delete[](void* p, align_val_t alignment, const nothrow_t&) noexcept { CountedFree(p, (size_t)alignment); }
+#endif
+
+BasicMachine::tStats BasicMachine::GetStats() const
+{
+    tStats result = stats;
+    result.expressionVectors = expressionAllocations;
+    result.heapAllocations = heapAllocations;
+    result.heapBytes = heapBytes;
+    return result;
+}
+
+void BasicMachine::ResetStats()
+{
+    memset(&stats, 0, sizeof(stats));
+    expressionAllocations = 0;
+    heapAllocations = 0;
+    heapBytes = 0;
+}
+
+uint64_t BasicMachine::StatementCount() const
+{
+    uint64_t count = 0;
+    for (uint64_t n : stats.statements)
+        count += n;
+    return count;
+}
@@ -0,0 +1,159 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <string.h>
+
+#include "Basic.h"
+
+#include <algorithm>
+
+// String heap. Optionally, as in Microsoft BASIC, the strings of variables and arrays are kept in one block of a fixed
+// size, each one is a length word followed by the characters. The strings are allocated one after another, a string
+// replaced by an assignment is left where it was. When the block is full, the live strings are found by going over
+// the variables and arrays and are moved together to the start of the block. This bounds the memory of a session and
+// saves an allocation for each string. FRE tells how much space is left.
+//
+// The strings of expressions are allocated as usual. A value read from a variable refers to the heap directly and is
+// only valid until the next compaction, which only happens while a string is stored.
+
+static size_t HeapWords(size_t length)
+{
+    return (sizeof(uint32_t) + length + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+}
+
+void BasicMachine::SetStringHeap(size_t bytes)
+{
+    MoveStringsOutOfHeap();
+    stringHeap.assign(bytes / sizeof(uint64_t), 0);
+    stringHeap.shrink_to_fit();
+    stringHeapTop = 0;
+}
+
+// The variables keep their strings when the heap goes away
+void BasicMachine::MoveStringsOutOfHeap()
+{
+    auto move = [](tValue& v)
+    {
+        if (holds_alternative<string>(v) && v.InHeap())
+            v = tValue(get<string>(v));
+    };
+    for (auto& v : vars)
+        move(v.value);
+    for (auto& ar : arrays)
+        for (auto& v : ar.strings)
+            move(v);
+}
+
+void BasicMachine::StoreHeapString(tValue& target, const tValue& val)
+{
+    string_view s = get<string>(val);
+    size_t words = HeapWords(s.length());
+
+    tValue copy;
+    if (stringHeapTop + words > stringHeap.size())
+    {
+        // The value may be in the heap itself and move
+        if (val.InHeap())
+        {
+            copy = tValue(s);
+            s = get<string>(copy);
+        }
+
+        target = tValue(); // The old string is garbage now
+        CompactStringHeap();
+        if (stringHeapTop + words > stringHeap.size())
+        {
+            target = string();
+            ErrorCondition("Out of string space");
+            return;
+        }
+    }
+
+    uint32_t* entry = (uint32_t*)&stringHeap[stringHeapTop];
+    *entry = (uint32_t)s.length();
+    memcpy(entry + 1, s.data(), s.length());
+    stringHeapTop += words;
+    target = tValue::FromHeap(entry);
+}
+
+// A$=A$+X, the last string of the heap grows in place
+void BasicMachine::AppendValue(tValue& target, const tValue& val)
+{
+    string_view s = get<string>(val);
+    if (!target.InHeap())
+    {
+        if (stringHeap.empty())
+            target.Append(s);
+        else
+            StoreHeapString(target, tValue::Concat(get<string>(target), s));
+        return;
+    }
+
+    uint32_t* entry = (uint32_t*)target.HeapEntry();
+    size_t words = HeapWords(*entry);
+    size_t grown = HeapWords(*entry + s.length());
+    if ((uint64_t*)entry + words == stringHeap.data() + stringHeapTop && stringHeapTop - words + grown <= stringHeap.size())
+    {
+        memmove((char*)(entry + 1) + *entry, s.data(), s.length());
+        *entry += (uint32_t)s.length();
+        stringHeapTop += grown - words;
+    }
+    else
+        StoreHeapString(target, tValue::Concat(get<string>(target), s));
+}
+
+void BasicMachine::CompactStringHeap()
+{
+    vector<tValue*> live;
+    auto add = [&live](tValue& v)
+    {
+        if (holds_alternative<string>(v) && v.InHeap())
+            live.push_back(&v);
+    };
+    for (auto& v : vars)
+        add(v.value);
+    for (auto& ar : arrays)
+        for (auto& v : ar.strings)
+            add(v);
+
+    // Moving in the address order, each string goes down or stays. Equal entries move once
+    sort(live.begin(), live.end(), [](const tValue* a, const tValue* b) { return a->HeapEntry() < b->HeapEntry(); });
+    size_t top = 0;
+    const uint32_t* previous = nullptr;
+    uint32_t* moved = nullptr;
+    for (tValue* v : live)
+    {
+        const uint32_t* entry = v->HeapEntry();
+        if (entry != previous)
+        {
+            size_t words = HeapWords(*entry);
+            moved = (uint32_t*)&stringHeap[top];
+            memmove(moved, entry, words * sizeof(uint64_t));
+            top += words;
+            previous = entry;
+        }
+        *v = tValue::FromHeap(moved);
+    }
+    stringHeapTop = top;
+}
+
+// What is left after a compaction. Values sharing an entry take its space once, as CompactStringHeap keeps it
+size_t BasicMachine::StringHeapFree() const
+{
+    vector<const uint32_t*> live;
+    auto add = [&live](const tValue& v)
+    {
+        if (holds_alternative<string>(v) && v.InHeap())
+            live.push_back(v.HeapEntry());
+    };
+    for (const auto& v : vars)
+        add(v.value);
+    for (const auto& ar : arrays)
+        for (const auto& v : ar.strings)
+            add(v);
+
+    sort(live.begin(), live.end());
+    live.erase(unique(live.begin(), live.end()), live.end());
+    size_t used = 0;
+    for (const uint32_t* entry : live)
+        used += HeapWords(*entry);
+    return (stringHeap.size() - used) * sizeof(uint64_t);
+}
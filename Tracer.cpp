@@ -0,0 +1,137 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+
+#include "Basic.h"
+
+// Tracer. GOSUB/RETURN, FOR/NEXT and INPUT record small binary events while the program runs, the buffer goes to a
+// temporary file when it fills up. When tracing stops, the events are paired and written as Chrome trace events
+// (complete events on one track per kind), ready for chrome://tracing or Perfetto. RUN FAST does its own GOSUB and
+// FOR, only INPUT is traced there.
+
+static const size_t kTraceBufferSize = 65536;
+
+void BasicMachine::StartTrace(const char* fileName)
+{
+    StopTrace();
+
+    traceFile = fileName;
+    traceLog = tmpfile();
+    traceEvents.clear();
+    traceEvents.reserve(kTraceBufferSize);
+    traceStart = chrono::steady_clock::now();
+    tracing = true;
+}
+
+void BasicMachine::TraceEvent(int kind, bool begin, int operand)
+{
+    if (traceEvents.size() == kTraceBufferSize)
+    {
+        if (traceLog != nullptr)
+            fwrite(traceEvents.data(), sizeof(tTraceEvent), traceEvents.size(), traceLog);
+        traceEvents.clear();
+    }
+
+    traceEvents.push_back({ (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - traceStart).count(),
+        (uint8_t)kind, begin, executionPointer.lineNum, (uint16_t)operand });
+}
+
+// GOSUB, FOR and INPUT stopped by END or an error, everything still open ends here
+void BasicMachine::TraceReset()
+{
+    if (tracing)
+        TraceEvent(kTraceReset, false, 0);
+}
+
+// Writes the trace, false if the file cannot be written
+bool BasicMachine::StopTrace()
+{
+    if (!tracing)
+        return true;
+    tracing = false;
+
+    FILE* out = fopen(traceFile.c_str(), "wt");
+    if (out == nullptr)
+    {
+        if (traceLog != nullptr)
+            fclose(traceLog);
+        traceLog = nullptr;
+        traceEvents.clear();
+        return false;
+    }
+
+    fprintf(out, "{\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"GOSUB\"}},\n", kTraceGosub);
+    fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"FOR\"}},\n", kTraceFor);
+    fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"INPUT\"}}", kTraceInput);
+
+    // The open events of each kind are kept in the same stacks the machine keeps, NEXT of an outer loop ends the
+    // inner ones too
+    vector<tTraceEvent> open[kTraceReset];
+    uint64_t last = 0;
+    auto complete = [&](const tTraceEvent& begin, uint64_t end)
+    {
+        string name;
+        switch (begin.kind)
+        {
+        case kTraceGosub: name = "GOSUB " + to_string(begin.operand); break;
+        case kTraceFor: name = "FOR " + (begin.operand < vars.size() ? vars[begin.operand].name : string("?")); break;
+        default: name = "INPUT"; break;
+        }
+        fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"line\":%d}}",
+            name.c_str(), begin.kind, begin.time / 1000.0, (end - begin.time) / 1000.0, begin.lineNum);
+    };
+    auto process = [&](const tTraceEvent& e)
+    {
+        last = e.time;
+        if (e.kind == kTraceReset)
+        {
+            for (auto& events : open)
+            {
+                while (!events.empty())
+                {
+                    complete(events.back(), e.time);
+                    events.pop_back();
+                }
+            }
+            return;
+        }
+
+        auto& events = open[e.kind];
+        if (e.begin)
+        {
+            events.push_back(e);
+            return;
+        }
+        while (!events.empty())
+        {
+            tTraceEvent begin = events.back();
+            events.pop_back();
+            complete(begin, e.time);
+            if (e.kind != kTraceFor || begin.operand == e.operand)
+                break;
+        }
+    };
+
+    if (traceLog != nullptr)
+    {
+        rewind(traceLog);
+        tTraceEvent e;
+        while (fread(&e, sizeof(e), 1, traceLog) == 1)
+            process(e);
+        fclose(traceLog);
+        traceLog = nullptr;
+    }
+    for (const auto& e : traceEvents)
+        process(e);
+    traceEvents.clear();
+    traceEvents.shrink_to_fit();
+
+    // Still running when the trace was stopped
+    for (auto& events : open)
+        for (const auto& e : events)
+            complete(e, last);
+
+    fprintf(out, "\n]}\n");
+    fclose(out);
+    return true;
+}
@@ -0,0 +1,526 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "Basic.h"
+
+#include <set>
+#include <chrono>
+#include <thread>
+
+// Ahead of time compilation to C++. The generator works from the RUN FAST bytecode, so the typing and the register
+// allocation are the same, and the generated code mirrors ExecuteFast one instruction at a time. The rest of this
+// file is the runtime part used by the generated code.
+
+// The numeric functions are called directly so the C++ compiler can inline them, the overloads for the number type
+typedef tNumber (*tMathFunction)(tNumber);
+static constexpr tMathFunction Math(tMathFunction f) { return f; }
+
+static const struct
+{
+    tNumber (*compute)(tNumber);
+    const char* name;
+} nativeFunctions[] =
+{
+    { Math(fabs), "fabs" },
+    { Math(atan), "atan" },
+    { Math(cos), "cos" },
+    { Math(exp), "exp" },
+    { Math(floor), "floor" },
+    { Math(log), "log" },
+    { Math(sin), "sin" },
+    { Math(sqrt), "sqrt" },
+    { Math(tan), "tan" }
+};
+
+// Suffix of the constants in the generated code
+static const char* const kNumberSuffix = sizeof(tNumber) == sizeof(float) ? "f" : "";
+
+static string Quote(const string& s)
+{
+    string result{ '"' };
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        result += c;
+    }
+    return result + '"';
+}
+
+string BasicMachine::TranspiledOperand(int reg, bool isString) const
+{
+    char buffer[40];
+    bool constant = !isString && reg < 0 && reg >= -fastProgram.numberConstants;
+    tNumber value = constant ? fastProgram.numbers[fastProgram.numberConstants + reg] : 0.0f;
+    if (constant && isfinite(value))
+        sprintf(buffer, value < 0 ? "(%a%s)" : "%a%s", (double)value, kNumberSuffix); // Hex float is exact
+    else
+        sprintf(buffer, "%c[%d]", isString ? 'S' : 'N', reg);
+    return buffer;
+}
+
+bool BasicMachine::EmitCpp(const char* sourceName, const char* targetName)
+{
+    // The program is loaded by LOAD as if it was typed in
+    ResetMachine();
+    string command = string("LOAD \"") + sourceName + '"';
+    const char* ptr = command.c_str();
+    commandLine = ParseCommandLine(ptr).second;
+    if (!inErrorCondition)
+        ExecuteAtPC();
+    if (inErrorCondition)
+        return false;
+
+    // The source lines are embedded as they are (listing does not always reproduce numbers exactly), and compiled
+    // here the same way they will be at startup
+    vector<string> source;
+    FILE* fin = fopen(sourceName, "rt");
+    while (fin != nullptr && !feof(fin))
+    {
+        char buff[257];
+        buff[0] = 0;
+        fgets(buff, 257, fin);
+        buff[strcspn(buff, "\r\n")] = 0;
+        if (strlen(buff) > 0)
+            source.push_back(buff);
+    }
+    if (fin != nullptr)
+        fclose(fin);
+
+    vector<const char*> lines;
+    for (const auto& line : source)
+        lines.push_back(line.c_str());
+    lines.push_back(nullptr);
+    if (!LoadTranspiled(lines.data(), SIZE_MAX))
+        return false;
+
+    const auto& code = fastProgram.code;
+    auto N = [this](int reg) { return TranspiledOperand(reg, false); };
+    auto S = [this](int reg) { return TranspiledOperand(reg, true); };
+
+    // Everything that may be jumped to gets a label
+    set<size_t> labels, returns, bodies;
+    for (size_t pc = 0; pc < code.size(); ++pc)
+    {
+        const tFastInstruction& i = code[pc];
+        if (i.code >= FastOp::Jump && i.code <= FastOp::Gosub)
+            labels.insert(i.a);
+        if (i.code == FastOp::Gosub || (i.code == FastOp::On && i.d))
+            returns.insert(pc + 1);
+        if (i.code == FastOp::On)
+            for (int k = 0; k < i.c; ++k)
+                if (fastProgram.jumpTables[i.b + k] >= 0)
+                    labels.insert(fastProgram.jumpTables[i.b + k]);
+        if (i.code == FastOp::For)
+            bodies.insert(pc + 1);
+    }
+    labels.insert(returns.begin(), returns.end());
+    labels.insert(bodies.begin(), bodies.end());
+
+    auto jumpSwitch = [](FILE* out, const char* value, const set<size_t>& targets)
+    {
+        fprintf(out, "        switch (%s)\n        {\n", value);
+        for (size_t target : targets)
+            fprintf(out, "        case %zu: goto P%zu;\n", target, target);
+        fprintf(out, "        }\n");
+    };
+
+    FILE* out = fopen(targetName, "wt");
+    if (out == nullptr)
+    {
+        ErrorCondition("Error opening file");
+        return false;
+    }
+
+    fprintf(out, "// Generated from %s by basic --emit-cpp. Build it together with the interpreter sources with\n", sourceName);
+    fprintf(out, "// BASIC_TRANSPILED defined, those are the runtime.\n");
+    fprintf(out, "#define _CRT_SECURE_NO_WARNINGS\n#include <stdio.h>\n#include <stdlib.h>\n#include <math.h>\n\n#include \"Basic.h\"\n\n#include <algorithm>\n\n");
+    fprintf(out, "static_assert(sizeof(tNumber) == %zu, \"the runtime has to be built with the same number type\");\n\n", sizeof(tNumber));
+    fprintf(out, "void BasicMachine::ExecuteTranspiled()\n{\n    static const char* const source[] =\n    {\n");
+    for (const auto& line : source)
+        fprintf(out, "        %s,\n", Quote(line).c_str());
+    fprintf(out, "        nullptr\n    };\n\n");
+    fprintf(out, "    if (!LoadTranspiled(source, %zu))\n        return;\n\n", code.size());
+    fprintf(out, "    tNumber* N = fastProgram.numbers.data() + fastProgram.numberConstants;\n");
+    fprintf(out, "    string* S = fastProgram.strings.data() + fastProgram.stringConstants;\n");
+    fprintf(out, "    vector<tFastLoop> loops;\n    vector<size_t> returns;\n");
+
+    for (size_t pc = 0; pc < code.size(); ++pc)
+    {
+        const tFastInstruction& i = code[pc];
+        if (pc == 0 || fastProgram.lines[pc] != fastProgram.lines[pc - 1])
+        {
+            // Backslash at the end of a comment would continue it on the next line
+            const tLinkedLine& line = programLines[fastProgram.lines[pc]];
+            string listing = ListStatement(line.lineNum, program[line.lineNum]);
+            replace(listing.begin(), listing.end(), '\\', '/');
+            fprintf(out, "\n    // %s\n", listing.c_str());
+        }
+        if (labels.count(pc))
+            fprintf(out, "P%zu:\n", pc);
+
+        string a = N(i.a), b = N(i.b), c = N(i.c);
+        switch (i.code)
+        {
+        case FastOp::NMove: fprintf(out, "    %s = %s;\n", a.c_str(), b.c_str()); break;
+        case FastOp::SMove: fprintf(out, "    %s = %s;\n", S(i.a).c_str(), S(i.b).c_str()); break;
+        case FastOp::NAdd: fprintf(out, "    %s = %s + %s;\n", a.c_str(), b.c_str(), c.c_str()); break;
+        case FastOp::NSubtract: fprintf(out, "    %s = %s - %s;\n", a.c_str(), b.c_str(), c.c_str()); break;
+        case FastOp::NMultiply: fprintf(out, "    %s = %s * %s;\n", a.c_str(), b.c_str(), c.c_str()); break;
+        case FastOp::NDivide:
+            if (i.c >= 0 || fastProgram.numbers[fastProgram.numberConstants + i.c] == 0.0f)
+                fprintf(out, "    if (%s == 0.0f)\n    {\n        TranspiledError(%zu, \"Division by zero\");\n        return;\n    }\n", c.c_str(), pc);
+            fprintf(out, "    %s = %s / %s;\n", a.c_str(), b.c_str(), c.c_str());
+            break;
+        case FastOp::NPower: fprintf(out, "    %s = pow(%s, %s);\n", a.c_str(), b.c_str(), c.c_str()); break;
+        case FastOp::NNegate: fprintf(out, "    %s = -%s;\n", a.c_str(), b.c_str()); break;
+        case FastOp::NNot: fprintf(out, "    %s = (tNumber)(%s == 0.0f);\n", a.c_str(), b.c_str()); break;
+        case FastOp::NAnd: fprintf(out, "    %s = (tNumber)(%s != 0.0f && %s != 0.0f);\n", a.c_str(), b.c_str(), c.c_str()); break;
+        case FastOp::NOr: fprintf(out, "    %s = (tNumber)(%s != 0.0f || %s != 0.0f);\n", a.c_str(), b.c_str(), c.c_str()); break;
+        case FastOp::NLess: fprintf(out, "    %s = (tNumber)(%s < %s);\n", a.c_str(), b.c_str(), c.c_str()); break;
+        case FastOp::NLessOrEqual: fprintf(out, "    %s = (tNumber)(%s <= %s);\n", a.c_str(), b.c_str(), c.c_str()); break;
+        case FastOp::NGreater: fprintf(out, "    %s = (tNumber)(%s > %s);\n", a.c_str(), b.c_str(), c.c_str()); break;
+        case FastOp::NGreaterOrEqual: fprintf(out, "    %s = (tNumber)(%s >= %s);\n", a.c_str(), b.c_str(), c.c_str()); break;
+        case FastOp::NEqual: fprintf(out, "    %s = (tNumber)(%s == %s);\n", a.c_str(), b.c_str(), c.c_str()); break;
+        case FastOp::NNotEqual: fprintf(out, "    %s = (tNumber)(%s != %s);\n", a.c_str(), b.c_str(), c.c_str()); break;
+
+        case FastOp::SConcat:
+            if (i.a == i.b && i.a != i.c)
+                fprintf(out, "    %s += %s;\n", S(i.a).c_str(), S(i.c).c_str());
+            else
+                fprintf(out, "    %s = %s + %s;\n", S(i.a).c_str(), S(i.b).c_str(), S(i.c).c_str());
+            break;
+
+        case FastOp::SCompare:
+        {
+            static const char* const comparisons[] = { "<", "<=", ">", ">=", "==", "!=" };
+            fprintf(out, "    %s = (tNumber)(%s.compare(%s) %s 0);\n", a.c_str(), S(i.b).c_str(), S(i.c).c_str(), comparisons[i.d]);
+            break;
+        }
+
+        case FastOp::NFunction:
+        {
+            const char* name = nullptr;
+            for (const auto& f : nativeFunctions)
+                if (f.compute == FastFunction(i.d))
+                    name = f.name;
+            if (name != nullptr)
+                fprintf(out, "    %s = %s(%s);\n", a.c_str(), name, b.c_str());
+            else
+                fprintf(out, "    %s = FastFunction(%d)(%s);\n", a.c_str(), i.d, b.c_str());
+            break;
+        }
+
+        case FastOp::SLen: fprintf(out, "    %s = (tNumber)%s.length();\n", a.c_str(), S(i.b).c_str()); break;
+        case FastOp::SAsc: fprintf(out, "    %s = (tNumber)%s[0];\n", a.c_str(), S(i.b).c_str()); break;
+        case FastOp::SVal: fprintf(out, "    %s = (tNumber)atof(%s.c_str());\n", a.c_str(), S(i.b).c_str()); break;
+        case FastOp::SChr: fprintf(out, "    %s = string{ (char)%s };\n", S(i.a).c_str(), b.c_str()); break;
+
+        case FastOp::SStr:
+            fprintf(out, "    {\n        char buffer[30];\n        sprintf(buffer, \"%%.*g\", tBasicPolicy::printDigits, %s);\n        %s = buffer;\n    }\n", b.c_str(), S(i.a).c_str());
+            break;
+
+        case FastOp::SLeft:
+            fprintf(out, "    %s = %s.substr(0, min((int)%s, (int)%s.length()));\n", S(i.a).c_str(), S(i.b).c_str(), c.c_str(), S(i.b).c_str());
+            break;
+
+        case FastOp::SRight:
+            fprintf(out, "    %s = %s.substr(max(0, (int)%s.length() - (int)%s), string::npos);\n", S(i.a).c_str(), S(i.b).c_str(), S(i.b).c_str(), c.c_str());
+            break;
+
+        case FastOp::SMid:
+        case FastOp::SMidCount:
+            fprintf(out, "    {\n        int length = %s.length();\n        int from = min(length, (int)%s) - 1;\n", S(i.b).c_str(), c.c_str());
+            fprintf(out, "        if (from < 0)\n        {\n            TranspiledError(%zu, \"Bad expression\");\n            return;\n        }\n", pc);
+            if (i.code == FastOp::SMidCount)
+                fprintf(out, "        %s = %s.substr(from, min(length - from, (int)%s));\n    }\n", S(i.a).c_str(), S(i.b).c_str(), N(i.d).c_str());
+            else
+                fprintf(out, "        %s = %s.substr(from, length - from);\n    }\n", S(i.a).c_str(), S(i.b).c_str());
+            break;
+
+        case FastOp::SSysVar:
+            fprintf(out, "    {\n        const tValue& value = systemVarInfo[%d].do_eval(*this);\n", i.d);
+            fprintf(out, "        %s = holds_alternative<string>(value) ? get<string>(value) : string();\n    }\n", S(i.a).c_str());
+            break;
+
+        case FastOp::NArrayLoad1:
+        case FastOp::NArrayLoad2:
+        case FastOp::SArrayLoad1:
+        case FastOp::SArrayLoad2:
+        case FastOp::NArrayStore1:
+        case FastOp::NArrayStore2:
+        case FastOp::SArrayStore1:
+        case FastOp::SArrayStore2:
+        {
+            bool two = i.code == FastOp::NArrayLoad2 || i.code == FastOp::SArrayLoad2 || i.code == FastOp::NArrayStore2 || i.code == FastOp::SArrayStore2;
+            bool numeric = i.code <= FastOp::NArrayStore2;
+            bool store = i.code == FastOp::NArrayStore1 || i.code == FastOp::NArrayStore2 || i.code == FastOp::SArrayStore1 || i.code == FastOp::SArrayStore2;
+            fprintf(out, "    {\n        int element = TranspiledElement(%zu, %d, %s", pc, i.d, b.c_str());
+            if (two)
+                fprintf(out, ", %s", c.c_str());
+            fprintf(out, ");\n        if (element < 0)\n            return;\n");
+            string reg = numeric ? a : S(i.a);
+            if (store && !numeric)
+                fprintf(out, "        if (!FastStoreString(%zu, arrays[%d].strings[element], %s))\n            return;\n    }\n", pc, i.d, reg.c_str());
+            else if (store)
+                fprintf(out, "        arrays[%d].numbers[element] = %s;\n    }\n", i.d, reg.c_str());
+            else if (numeric)
+                fprintf(out, "        %s = arrays[%d].numbers[element];\n    }\n", reg.c_str(), i.d);
+            else
+                fprintf(out, "        %s = get<string>(arrays[%d].strings[element]);\n    }\n", reg.c_str(), i.d);
+            break;
+        }
+
+        case FastOp::Jump:
+            fprintf(out, "    if (TranspiledBreak())\n        return;\n    goto P%d;\n", i.a);
+            break;
+
+        case FastOp::JumpIfZero: fprintf(out, "    if (%s == 0.0f)\n        goto P%d;\n", b.c_str(), i.a); break;
+        case FastOp::JumpIfNotLess: fprintf(out, "    if (!(%s < %s))\n        goto P%d;\n", b.c_str(), c.c_str(), i.a); break;
+        case FastOp::JumpIfNotLessOrEqual: fprintf(out, "    if (!(%s <= %s))\n        goto P%d;\n", b.c_str(), c.c_str(), i.a); break;
+        case FastOp::JumpIfNotGreater: fprintf(out, "    if (!(%s > %s))\n        goto P%d;\n", b.c_str(), c.c_str(), i.a); break;
+        case FastOp::JumpIfNotGreaterOrEqual: fprintf(out, "    if (!(%s >= %s))\n        goto P%d;\n", b.c_str(), c.c_str(), i.a); break;
+        case FastOp::JumpIfNotEqual: fprintf(out, "    if (!(%s == %s))\n        goto P%d;\n", b.c_str(), c.c_str(), i.a); break;
+        case FastOp::JumpIfEqual: fprintf(out, "    if (!(%s != %s))\n        goto P%d;\n", b.c_str(), c.c_str(), i.a); break;
+
+        case FastOp::Gosub:
+            fprintf(out, "    returns.push_back(%zu);\n    if (TranspiledBreak())\n        return;\n    goto P%d;\n", pc + 1, i.a);
+            break;
+
+        case FastOp::Return:
+            fprintf(out, "    if (returns.empty())\n    {\n        TranspiledError(%zu, \"Stack underflow\");\n        return;\n    }\n", pc);
+            fprintf(out, "    {\n        size_t target = returns.back();\n        returns.pop_back();\n        if (TranspiledBreak())\n            return;\n");
+            jumpSwitch(out, "target", returns);
+            fprintf(out, "        return;\n    }\n");
+            break;
+
+        case FastOp::On:
+            // The out of range value continues the execution, same as in the interpreter
+            fprintf(out, "    switch ((int)%s - 1)\n    {\n", a.c_str());
+            for (int k = 0; k < i.c; ++k)
+            {
+                int target = fastProgram.jumpTables[i.b + k];
+                fprintf(out, "    case %d:\n", k);
+                if (target < 0)
+                {
+                    fprintf(out, "        TranspiledError(%zu, \"ON - line not found\");\n        return;\n", pc);
+                    continue;
+                }
+                if (i.d)
+                    fprintf(out, "        returns.push_back(%zu);\n", pc + 1);
+                fprintf(out, "        if (TranspiledBreak())\n            return;\n        goto P%d;\n", target);
+            }
+            fprintf(out, "    }\n");
+            break;
+
+        case FastOp::For:
+            fprintf(out, "    loops.push_back({ %d, %s, %s, %zu });\n", i.a, b.c_str(), c.c_str(), pc + 1);
+            break;
+
+        case FastOp::Next:
+            fprintf(out, "    {\n        size_t body;\n        if (!TranspiledNext(%zu, loops, body))\n            return;\n", pc);
+            jumpSwitch(out, "body", bodies);
+            fprintf(out, "    }\n");
+            break;
+
+        case FastOp::EvalCondition:
+        case FastOp::EvalNumber:
+        case FastOp::Interpret:
+            fprintf(out, "    if (!TranspiledInterpret(%zu))\n        return;\n", pc);
+            break;
+
+        case FastOp::Error:
+            fprintf(out, "    TranspiledError(%zu, fastProgram.messages[%d]);\n    return;\n", pc, i.d);
+            break;
+
+        case FastOp::End:
+            fprintf(out, "    FastSyncOut();\n    ExecuteEnd(nullptr);\n    return;\n");
+            break;
+        }
+    }
+
+    fprintf(out, "}\n");
+    fclose(out);
+    return true;
+}
+
+// Parses the program text, links and compiles it. The generated code checks that the bytecode is the same one it
+// was generated from.
+bool BasicMachine::LoadTranspiled(const char* const* source, size_t codeSize)
+{
+    transpiledLoaded = false;
+    ResetMachine();
+    StartKeyboard();
+    ExecuteNew(nullptr);
+    for (; *source != nullptr; ++source)
+    {
+        const char* ptr = *source;
+        auto parsed = ParseCommandLine(ptr);
+        if (inErrorCondition)
+        {
+            OutputLine(*source);
+            return false;
+        }
+        if (parsed.first <= kCommandLine)
+        {
+            ErrorCondition("Invalid line in the source file");
+            return false;
+        }
+        program[parsed.first] = move(parsed.second);
+    }
+
+    if (program.empty())
+    {
+        ErrorCondition("Nothing to compile");
+        return false;
+    }
+
+    StartProgram();
+    if (!CompileFast() || (codeSize != SIZE_MAX && fastProgram.code.size() != codeSize))
+    {
+        ExecuteEnd(nullptr);
+        ErrorCondition("The program cannot be compiled");
+        return false;
+    }
+
+    FastSyncIn();
+    transpiledLoaded = true;
+    return true;
+}
+
+void BasicMachine::TranspiledError(size_t pc, const char* message)
+{
+    executionPointer.line = fastProgram.lines[pc];
+    executionPointer.lineNum = programLines[executionPointer.line].lineNum;
+    FastSyncOut();
+    ErrorCondition(message);
+}
+
+bool BasicMachine::TranspiledBreak()
+{
+    if (TestKeyboard() != 27)
+        return false;
+    FastSyncOut();
+    ExecuteEnd(nullptr);
+    return true;
+}
+
+// Same as the bytecode, the indexes are checked against the dimensions. The element index, -1 after an error
+int BasicMachine::TranspiledElement(size_t pc, int ar, tNumber i)
+{
+    const auto& dimensions = arrays[ar].dimensions;
+    int n = (int)i;
+    if (dimensions.size() == 1 && n >= 0 && n < dimensions[0])
+        return n;
+    TranspiledError(pc, "Bad array index");
+    return -1;
+}
+
+int BasicMachine::TranspiledElement(size_t pc, int ar, tNumber i, tNumber j)
+{
+    const auto& dimensions = arrays[ar].dimensions;
+    int n = (int)i;
+    int m = (int)j;
+    if (dimensions.size() == 2 && n >= 0 && n < dimensions[0] && m >= 0 && m < dimensions[1])
+        return n * arrays[ar].strides[0] + m;
+    TranspiledError(pc, "Bad array index");
+    return -1;
+}
+
+// Statements and expressions handed to the interpreter, false if the program has stopped
+bool BasicMachine::TranspiledInterpret(size_t pc)
+{
+    const tFastInstruction& i = fastProgram.code[pc];
+    tNumber* N = fastProgram.numbers.data() + fastProgram.numberConstants;
+
+    // When the program stops here, the variables the statement did not use get their values as well
+    const vector<int>* used = FastHandOff(pc);
+    executionPointer.line = fastProgram.lines[pc];
+    executionPointer.lineNum = programLines[executionPointer.line].lineNum;
+    FastSyncOut(used);
+    if (inErrorCondition)
+        return false;
+    if (i.code == FastOp::Interpret)
+    {
+        executionPointer.line = i.b;
+        executionPointer.lineNum = programLines[i.b].lineNum;
+        executionPointer.offset = i.c;
+        const byte* instruction = programImage.data() + i.a;
+        (this->*instructionInfo[(int)*instruction].do_execute)(instruction + 1);
+        FastSyncIn(used);
+        if (executionPointer.lineNum <= kCommandLine)
+        {
+            if (used != nullptr)
+                FastSyncOut();
+            return false;
+        }
+        return true;
+    }
+
+    const byte* expression = programImage.data() + i.b;
+    auto val = EvaluateExpression(expression);
+    if (executionPointer.lineNum <= kCommandLine)
+    {
+        if (used != nullptr)
+            FastSyncOut();
+        return false;
+    }
+
+    bool condition = i.code == FastOp::EvalCondition;
+    if (val.size() == 1 && val[0].IsNumeric())
+        N[i.a] = condition ? (tNumber)(val[0].Number() != 0.0f) : val[0].Number();
+    else if (val.size() == 1 && condition && holds_alternative<string>(val[0]))
+        N[i.a] = (tNumber)(get<string>(val[0]).length() > 0);
+    else
+    {
+        TranspiledError(pc, condition ? "Bad IF expression" : fastProgram.messages[i.d]);
+        return false;
+    }
+    return true;
+}
+
+// NEXT, the body is SIZE_MAX when the loop is over. False if the program has stopped.
+bool BasicMachine::TranspiledNext(size_t pc, vector<tFastLoop>& loops, size_t& body)
+{
+    const tFastInstruction& i = fastProgram.code[pc];
+    tNumber* N = fastProgram.numbers.data() + fastProgram.numberConstants;
+    body = SIZE_MAX;
+
+    int var = i.a < 0 && !loops.empty() ? loops.back().var : i.a;
+    while (!loops.empty() && loops.back().var != var)
+        loops.pop_back();
+    if (loops.empty())
+    {
+        TranspiledError(pc, "NEXT without FOR");
+        return false;
+    }
+
+    tFastLoop& loop = loops.back();
+    tNumber val = N[var] + loop.step;
+    N[var] = val;
+    if ((val - loop.limit) * loop.step <= 0)
+    {
+        if (loop.body == (size_t)i.b)
+        {
+            // Loop without a body, must be a delay loop
+            int count = loop.step == 0 ? 1 : (int)((loop.limit - val + loop.step) / loop.step);
+            if (count > 0)
+            {
+                this_thread::sleep_for(chrono::milliseconds(count));
+                N[var] = val + count * loop.step;
+                loops.pop_back();
+            }
+        }
+        else
+        {
+            body = loop.body;
+            if (TranspiledBreak())
+                return false;
+        }
+    }
+    else
+        loops.pop_back();
+    return true;
+}
@@ -1,28 +1,71 @@
 #define _CRT_SECURE_NO_WARNINGS
 #include "Basic.h"
+#include <limits.h>
+#include <string.h>
 #include <time.h>
 
-int BasicMachine::ExpressionToIndex(byte ar, const tExpressionValue& val)
+// The values are the indexes with the separators between them. One and two dimensions, almost all the arrays there
+// are, go the short way. The element index, -1 if the indexes do not fit the dimensions
+int BasicMachine::ElementIndex(const tArrayInfo& ai, const tValue* val, size_t count)
 {
-    const auto& arInfo = arrays[(int)ar];
-    if (val.size() != arInfo.dimensions.size() * 2 - 1)
+    const auto& dimensions = ai.dimensions;
+    if (count != dimensions.size() * 2 - 1)
         return -1;
-    int index = 0;
-    for (size_t i = 0; i < arInfo.dimensions.size(); ++i)
+    auto IndexValue = [](const tValue& v) { return !v.IsNumeric() ? -1 : holds_alternative<int>(v) ? get<int>(v) : (int)get<tNumber>(v); };
+
+    if (count == 1)
+    {
+        int n = IndexValue(val[0]);
+        return n >= 0 && n < dimensions[0] ? n : -1;
+    }
+
+    if (count == 3)
     {
-        if (!holds_alternative<float>(val[2 * i]) || (i > 0 && !holds_alternative<tSeparator>(val[2 * i - 1])))
+        int n = IndexValue(val[0]);
+        int m = IndexValue(val[2]);
+        if (!holds_alternative<tSeparator>(val[1]) || n < 0 || n >= dimensions[0] || m < 0 || m >= dimensions[1])
             return -1;
-        if ((int)get<float>(val[2 * i]) > arInfo.dimensions[i])
+        return n * ai.strides[0] + m;
+    }
+
+    int index = 0;
+    for (size_t i = 0; i < dimensions.size(); ++i)
+    {
+        int n = IndexValue(val[2 * i]);
+        if ((i > 0 && !holds_alternative<tSeparator>(val[2 * i - 1])) || n < 0 || n >= dimensions[i])
             return -1;
-        index = index * arInfo.dimensions[i] + (int)get<float>(val[2 * i]);
+        index += n * ai.strides[i];
+    }
+    return index;
+}
+
+int BasicMachine::ExpressionToIndex(byte ar, const tExpressionValue& val)
+{
+    return ElementIndex(arrays[(int)ar], val.data(), val.size());
+}
+
+// The array is made with the default dimensions when the name is seen for the first time. -1 if there are too many
+int BasicMachine::ArrayIndex(const string& name)
+{
+    auto it = find_if(arrays.begin(), arrays.end(), [&name](const auto& e) { return name.compare(e.name) == 0; });
+    if (it != arrays.end())
+        return (int)(it - arrays.begin());
+
+    int index = (int)arrays.size();
+    if (index >= tBasicPolicy::maxArrays)
+    {
+        ErrorCondition("Too many arrays");
+        return -1;
     }
+    arrays.push_back({ name });
+    ArrayDefaultCreate((byte)index);
     return index;
 }
 
 void BasicMachine::ArrayDefaultCreate(byte ar)
 {
     tExpressionValue dims;
-    dims.push_back(float(10.0));
+    dims.push_back((tNumber)tBasicPolicy::defaultArraySize);
     ArrayCreate(ar, dims);
 }
 
@@ -32,62 +75,136 @@ bool BasicMachine::ArrayCreate(byte ar, const tExpressionValue& dims)
     if ((dims.size() & 1) == 0)
         return false;
 
-    ai.dimensions.clear();
-
-    int size = 1;
+    // Checked before anything changes, a failed DIM leaves the array as it was. Each size has to fit the short
+    // and all the elements an int index
+    vector<short> dimensions;
+    int64_t size = 1;
     for (size_t i = 0; i < dims.size(); i += 2)
     {
-        if (!holds_alternative<float>(dims[i]) || (i > 0 && !holds_alternative<tSeparator>(dims[i - 1])))
+        if (!dims[i].IsNumeric() || (i > 0 && !holds_alternative<tSeparator>(dims[i - 1])))
+            return false;
+        tNumber bound = dims[i].Number();
+        if (!(bound >= 0 && bound < SHRT_MAX))
+            return false;
+        dimensions.push_back((short)((int)bound + 1));
+        size *= dimensions.back();
+        if (size > INT_MAX)
             return false;
-        ai.dimensions.push_back((int)(get<float>(dims[i])) + 1);
-        size *= ai.dimensions.back();
     }
-    ai.value.clear();
+    ai.dimensions = move(dimensions);
+
+    // Row major, the last index steps by one
+    ai.strides.assign(ai.dimensions.size(), 1);
+    for (size_t i = ai.dimensions.size() - 1; i > 0; --i)
+        ai.strides[i - 1] = ai.strides[i] * ai.dimensions[i];
+
+    ai.numbers.clear();
+    ai.integers.clear();
+    ai.strings.clear();
     if (ai.name.back() == '$')
-        ai.value.resize(size, string());
+        ai.strings.resize(size, string());
+    else if (ai.name.back() == '%')
+        ai.integers.resize(size, 0);
     else
-        ai.value.resize(size, float(0.0));
+        ai.numbers.resize(size, tNumber(0.0));
     return true;
 }
 
-const BasicMachine::tValue& BasicMachine::ArrayGet(byte ar, const tExpressionValue& index)
+BasicMachine::tValue BasicMachine::ArrayGet(byte ar, const tExpressionValue& index)
 {
     int i = ExpressionToIndex(ar, index);
     if (i >= 0)
-        return arrays[(int)ar].value[i];
+        return ArrayElement(arrays[(int)ar], i);
     ErrorCondition("Bad array index");
-    return arrays[0].value[0];
+    return tValue();
 }
 
 bool BasicMachine::ArraySet(byte ar, const tExpressionValue& index, const tValue& val)
 {
     int i = ExpressionToIndex(ar, index);
     if (i >= 0)
+        return ArraySet(ar, i, val);
+    ErrorCondition("Bad array index");
+    return false;
+}
+
+// The element index is checked already
+bool BasicMachine::ArraySet(byte ar, int i, const tValue& val)
+{
+    if (StoreArrayElement(arrays[(int)ar], i, val))
+        return true;
+    ErrorCondition("Bad value type");
+    return false;
+}
+
+BasicMachine::tValue BasicMachine::ArrayElement(const tArrayInfo& ai, int i)
+{
+    switch (ai.name.back())
     {
-        if (arrays[(int)ar].value[i].index() == val.index())
+    case '$': return ai.strings[i];
+    case '%': return tValue::Integer(ai.integers[i]);
+    default:  return ai.numbers[i];
+    }
+}
+
+// False if the value is of the wrong type
+bool BasicMachine::StoreArrayElement(tArrayInfo& ai, int i, tValue val)
+{
+    switch (ai.name.back())
+    {
+    case '$':
+        if (!holds_alternative<string>(val))
+            return false;
+        StoreValue(ai.strings[i], move(val));
+        return true;
+    case '%':
+        if (!val.IsNumeric())
+            return false;
+        if (holds_alternative<tNumber>(val) && !ConvertNumber(tValue::Integer(0), val))
+            return true; // Overflow is reported already
+        ai.integers[i] = get<int>(val);
+        return true;
+    default:
+        if (!val.IsNumeric())
+            return false;
+        ai.numbers[i] = val.Number();
+        return true;
+    }
+}
+
+// A number stored into a variable of the other numeric type takes that type. Floats are rounded to the nearest
+// integer, as in Microsoft BASIC
+bool BasicMachine::ConvertNumber(const tValue& target, tValue& val)
+{
+    if (holds_alternative<tNumber>(target))
+        val = val.Number();
+    else if (holds_alternative<int>(target))
+    {
+        tNumber f = round(get<tNumber>(val));
+        if (!(f >= -2147483648.0f && f < 2147483648.0f))
         {
-            arrays[(int)ar].value[i] = val;
-            return true;
+            ErrorCondition("Overflow");
+            return false;
         }
-        else
-            ErrorCondition("Bad value type");
+        val = tValue::Integer((int)f);
     }
-    else
-        ErrorCondition("Bad array index");
-    return false;
+    return true;
 }
 
 
 void BasicMachine::ResetVars()
 {
     for (auto& v : vars)
-        if (holds_alternative<float>(v.value))
-            v.value = float(0.0);
+        if (holds_alternative<tNumber>(v.value))
+            v.value = tNumber(0.0);
+        else if (holds_alternative<int>(v.value))
+            v.value = tValue::Integer(0);
         else
             v.value = string();
 
     for (size_t i = 0; i < arrays.size(); ++i)
         ArrayDefaultCreate((byte)i);
+    stringHeapTop = 0;
 
     for (auto& u : userFunctions)
         u.body.clear();
@@ -95,15 +212,18 @@ void BasicMachine::ResetVars()
 
 bool BasicMachine::GetNextDataItem(tValue& val)
 {
+    if (!programLinked)
+        LinkProgram();
+
     if (!ScanForNextDataItem())
     {
         ErrorCondition("No DATA available");
         return false;
     }
 
-    const byte* dataPtr = readPointer.cachedStatement->second.data() + readPointer.offset + readPointer.itemOffset;
+    const byte* dataPtr = programImage.data() + programLines[readPointer.line].start + readPointer.offset + readPointer.itemOffset;
     const byte* dataNow = dataPtr;
-    if (GetNextTokenType(dataPtr) == TokenType::ttNumber)
+    if (IsNumberToken(GetNextTokenType(dataPtr)))
         val = EvaluateNumber(dataPtr);
     else
         val = EvaluateString(dataPtr);
@@ -116,10 +236,10 @@ bool BasicMachine::ScanForNextDataItem()
 {
     // Possible conditions at this point:
     // itemOffset == -1 - this is the first call to READ after RESTORE, need to find the first item
-    // cachedStatement is at the program.end() - no more data
+    // line is past the last linked line - no more data
     // itemOffset >= limit - reached the end of the statement, scan for the next one
 
-    if (readPointer.cachedStatement == program.end())
+    if (readPointer.line >= programLines.size())
         return false;
 
     if (readPointer.itemOffset == -1 || readPointer.itemOffset >= readPointer.limit)
@@ -129,48 +249,51 @@ bool BasicMachine::ScanForNextDataItem()
             readPointer.offset = 0;
         else
         {
-            const byte* lengthPtr = &readPointer.cachedStatement->second[readPointer.offset + 1];
+            const byte* lengthPtr = &programImage[programLines[readPointer.line].start + readPointer.offset + 1];
             readPointer.offset += DecodeParmsLength(lengthPtr) + 1 + SizeOfParmsLength();
         }
 
-        while(readPointer.cachedStatement != program.end())
+        while(readPointer.line < programLines.size())
         {
-            if (readPointer.offset >= readPointer.cachedStatement->second.size())
+            const tLinkedLine& line = programLines[readPointer.line];
+            if (readPointer.offset >= line.size)
             {
                 // Reached the end of the line, skip to next
-                if (++readPointer.cachedStatement == program.end())
+                if (++readPointer.line >= programLines.size())
                     break;
-                readPointer.lineNum = readPointer.cachedStatement->first;
+                readPointer.lineNum = programLines[readPointer.line].lineNum;
                 readPointer.offset = 0;
             }
             else
             {
-                if (instructionInfo[(int)readPointer.cachedStatement->second[readPointer.offset]].dataStatement)
+                const byte* statement = &programImage[line.start + readPointer.offset];
+                const byte* lengthPtr = statement + 1;
+                if (instructionInfo[(int)*statement].dataStatement)
                 {
                     // If this is a DATA statement
                     readPointer.itemOffset = 1 + SizeOfParmsLength(); // skipping instruction code and length
-                    const byte* lengthPtr = &readPointer.cachedStatement->second[readPointer.offset + 1];
                     readPointer.limit = DecodeParmsLength(lengthPtr) + 1 + SizeOfParmsLength();
                     break;
                 }
                 else
                 {
                     // Skip to the next statement on this line
-                    const byte* lengthPtr = &readPointer.cachedStatement->second[readPointer.offset + 1];
                     readPointer.offset += DecodeParmsLength(lengthPtr) + 1 + SizeOfParmsLength();
                 }
             }
         }
     }
 
-    return readPointer.cachedStatement != program.end();
+    return readPointer.line < programLines.size();
 }
 
 const BasicMachine::tValue& BasicMachine::GetVarInkey()
 {
     static tValue val;
-    if (lastKey)
-        val = move(string(1, lastKey));
+    if (outputFlush & kFlushInput)
+        FlushOutput();
+    if (char key = ReadKey())
+        val = move(string(1, key));
     else
         val = string();
     return val;
@@ -190,8 +313,92 @@ const BasicMachine::tValue& BasicMachine::GetVarTime()
     return val;
 }
 
+// As in later Microsoft BASICs, the command line tail
+const BasicMachine::tValue& BasicMachine::GetVarCommand()
+{
+    static tValue val;
+    val = commandArguments;
+    return val;
+}
+
 bool BasicMachine::SetProtectedVar(const tValue& val)
 {
     ErrorCondition("Cannot set protected variable");
     return false;
-}
\ No newline at end of file
+}
+
+// Shared strings
+
+BasicMachine::tStringData* BasicMachine::tValue::NewString(size_t length, size_t capacity)
+{
+    tStringData* s = (tStringData*)::operator new(sizeof(tStringData) + capacity);
+    s->refs = 1;
+    s->owner = nullptr;
+    s->text = (const char*)(s + 1);
+    s->length = length;
+    s->capacity = capacity;
+    return s;
+}
+
+void BasicMachine::tValue::FreeString(tStringData* s)
+{
+    tStringData* owner = s->owner;
+    ::operator delete(s);
+    if (owner != nullptr && --owner->refs == 0)
+        ::operator delete(owner);
+}
+
+BasicMachine::tValue::tValue(string_view s) : tValue(kString, (uintptr_t)NewString(s.length(), s.length()))
+{
+    memcpy((char*)Text()->text, s.data(), s.length());
+}
+
+BasicMachine::tValue BasicMachine::tValue::Slice(size_t from, size_t count) const
+{
+    if (InHeap())
+    {
+        string_view s = get<string>(*this);
+        return tValue(s.substr(min(from, s.length()), count));
+    }
+
+    const tStringData* s = Text();
+    from = min(from, s->length);
+    count = min(count, s->length - from);
+    if (count == s->length)
+        return *this;
+
+    // A slice header is as big as a short string, and should not keep a long one alive for a few characters
+    if (count < sizeof(tStringData))
+        return tValue(string_view(s->text + from, count));
+
+    tStringData* owner = s->owner != nullptr ? s->owner : Text();
+    ++owner->refs;
+    tStringData* slice = (tStringData*)::operator new(sizeof(tStringData));
+    *slice = { 1, owner, s->text + from, count, 0 };
+    return tValue(kString, (uintptr_t)slice);
+}
+
+BasicMachine::tValue BasicMachine::tValue::Concat(string_view a, string_view b)
+{
+    tStringData* s = NewString(a.length() + b.length(), a.length() + b.length());
+    memcpy((char*)s->text, a.data(), a.length());
+    memcpy((char*)s->text + a.length(), b.data(), b.length());
+    return tValue(kString, (uintptr_t)s);
+}
+
+// Appends in place when nobody else sees the string, otherwise to a copy with the room to grow, so building a string
+// a piece at a time takes linear time
+void BasicMachine::tValue::Append(string_view s)
+{
+    tStringData* target = Text();
+    if (target->refs != 1 || target->length + s.length() > target->capacity)
+    {
+        size_t length = target->length + s.length();
+        tStringData* grown = NewString(target->length, max(length, 2 * target->length));
+        memcpy((char*)grown->text, target->text, target->length);
+        *this = tValue(kString, (uintptr_t)grown);
+        target = grown;
+    }
+    memcpy((char*)target->text + target->length, s.data(), s.length());
+    target->length += s.length();
+}
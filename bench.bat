@@ -0,0 +1,3 @@
+@echo off
+rem Builds bench.exe and runs the benchmark programs, the results are written as JSON
+cl /std:c++17 /EHsc /O2 /DBASIC_BENCH /DBASIC_HEAP_STATS /Febench.exe bench\bench.cpp basic.cpp expression.cpp functions.cpp helpers.cpp instructions.cpp variables.cpp bytecode.cpp jit.cpp transpiler.cpp keyboard.cpp output.cpp sampler.cpp stats.cpp tracer.cpp stringheap.cpp matrix.cpp && bench.exe bench\data.bas bench\gosub.bas bench\strings.bas bench\numeric.bas bench\print.bas bench\sort.bas
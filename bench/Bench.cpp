@@ -0,0 +1,135 @@
+// Bench.cpp
+// Program level benchmark. Runs each program file in batch mode, first by the interpreter and then by RUN FAST, and
+// reports the timings as JSON. Built together with the interpreter sources with BASIC_BENCH defined (see bench.bat):
+//
+//   bench [--repeat N] program.bas...
+//
+// Statements per second are counted by the interpreter run, RUN FAST executes the same statements in less time. The
+// peak RSS is for the whole process up to that point, so the programs are better listed from small to large.
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../Basic.h"
+
+#include <chrono>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#define NULL_DEVICE "NUL"
+#else
+#include <sys/resource.h>
+#define NULL_DEVICE "/dev/null"
+#endif
+
+static long PeakRssKb()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return (long)(counters.PeakWorkingSetSize / 1024);
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#endif
+}
+
+struct tResult
+{
+    int exitCode;
+    double seconds;     // Best of the repeats
+    uint64_t statements;
+    uint64_t allocations, bytes;    // Heap, of the last repeat
+};
+
+static tResult Measure(BasicMachine& machine, const char* fileName, bool fast, int repeat)
+{
+    tResult result{ 0, 0.0, 0, 0, 0 };
+    for (int i = 0; i < repeat; ++i)
+    {
+        auto start = chrono::steady_clock::now();
+        result.exitCode = machine.RunBatch(fileName, "", fast);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        BasicMachine::tStats stats = machine.GetStats(); // RunBatch starts them over
+
+        if (i == 0 || seconds < result.seconds)
+            result.seconds = seconds;
+        result.statements = machine.StatementCount();
+        result.allocations = stats.heapAllocations;
+        result.bytes = stats.heapBytes;
+        if (result.exitCode != BasicMachine::kExitOk)
+            break;
+    }
+    return result;
+}
+
+// File names go into JSON strings, Windows paths have backslashes
+static string Escape(const char* s)
+{
+    string result;
+    for (; *s; ++s)
+    {
+        if (*s == '\\' || *s == '"')
+            result += '\\';
+        result += *s;
+    }
+    return result;
+}
+
+static void Report(const char* mode, const tResult& r, uint64_t statements)
+{
+    printf("\"%s\": { \"exit_code\": %d, \"wall_ms\": %.3f, \"statements_per_sec\": %.0f, \"allocations\": %llu, \"allocated_bytes\": %llu, \"peak_rss_kb\": %ld }",
+        mode, r.exitCode, r.seconds * 1000.0, r.seconds > 0.0 ? statements / r.seconds : 0.0,
+        (unsigned long long)r.allocations, (unsigned long long)r.bytes, PeakRssKb());
+}
+
+int main(int argc, char* argv[])
+{
+    int repeat = 3;
+    int arg = 1;
+    if (arg + 1 < argc && strcmp(argv[arg], "--repeat") == 0)
+    {
+        repeat = max(1, atoi(argv[arg + 1]));
+        arg += 2;
+    }
+    if (arg >= argc)
+    {
+        fprintf(stderr, "Usage: bench [--repeat N] program.bas...\n");
+        return 2;
+    }
+
+    FILE* discard = fopen(NULL_DEVICE, "w");
+    BasicMachine machine;
+    machine.Init();
+    machine.SetOutputPolicy(0, false);
+    if (discard != nullptr)
+        machine.SetOutputFile(discard);
+
+    int exitCode = 0;
+    printf("[\n");
+    for (int i = arg; i < argc; ++i)
+    {
+        tResult interpreted = Measure(machine, argv[i], false, repeat);
+        tResult fast = Measure(machine, argv[i], true, repeat);
+        if (interpreted.exitCode != BasicMachine::kExitOk || fast.exitCode != BasicMachine::kExitOk)
+            exitCode = 1;
+
+        printf("  { \"program\": \"%s\", \"statements\": %llu,\n    ", Escape(argv[i]).c_str(), (unsigned long long)interpreted.statements);
+        Report("interpreter", interpreted, interpreted.statements);
+        printf(",\n    ");
+        Report("fast", fast, interpreted.statements);
+        printf(" }%s\n", i + 1 < argc ? "," : "");
+    }
+    printf("]\n");
+
+    machine.SetOutputFile(stdout);
+    if (discard != nullptr)
+        fclose(discard);
+    return exitCode;
+}
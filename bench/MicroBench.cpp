@@ -0,0 +1,164 @@
+// MicroBench.cpp
+// Micro-benchmarks of the parser and evaluator internals. Each one calls a single BasicMachine member on a prepared
+// input and reports the time and allocations per call as JSON. Built together with the interpreter sources with
+// BASIC_BENCH defined (see microbench.bat):
+//
+//   microbench [name...]
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <string.h>
+
+#include "../Basic.h"
+
+#include <algorithm>
+#include <chrono>
+
+class BasicBenchmark
+{
+    BasicMachine m;
+    int selected;
+    char** names;
+    bool first = true;
+
+    // Repeats the operation in growing batches until a batch takes long enough to measure
+    template <class F> void Measure(const char* name, F operation)
+    {
+        if (selected > 0 && find_if(names, names + selected, [name](const char* n) { return strcmp(n, name) == 0; }) == names + selected)
+            return;
+
+        operation();
+        for (uint64_t count = 16;; count *= 2)
+        {
+            uint64_t allocations = m.GetStats().heapAllocations;
+            auto start = chrono::steady_clock::now();
+            for (uint64_t i = 0; i < count; ++i)
+                operation();
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            allocations = m.GetStats().heapAllocations - allocations;
+
+            if (seconds >= 0.2)
+            {
+                printf("%s  { \"name\": \"%s\", \"ns_per_op\": %.1f, \"allocations_per_op\": %.2f }", first ? "" : ",\n", name,
+                    seconds * 1e9 / count, (double)allocations / count);
+                first = false;
+                return;
+            }
+        }
+    }
+
+    // Same as RESTORE without a line number
+    void Restore()
+    {
+        m.readPointer.lineNum = m.programLines[0].lineNum;
+        m.readPointer.offset = 0;
+        m.readPointer.line = 0;
+        m.readPointer.itemOffset = -1;
+        m.readPointer.limit = 0;
+    }
+
+public:
+    BasicBenchmark(int count, char** list) : selected(count), names(list) {}
+
+    bool Run()
+    {
+        m.Init();
+        m.ResetMachine();
+        m.ExecuteNew(nullptr);
+
+        static const char* const source[] =
+        {
+            "10 DATA 1,2,3,\"FOUR\",5.5,\"SIX\"",
+            "20 DATA 7,8,9,10",
+            "30 IF A(I)>B THEN PRINT \"X\";A$+MID$(B$,2,3):GOTO 10",
+            "40 FOR J=1 TO 10 STEP 2:C=C+(A+B*2)/SQR(C)-INT(D/3):NEXT J",
+            nullptr
+        };
+        for (auto line = source; *line != nullptr; ++line)
+        {
+            const char* ptr = *line;
+            auto parsed = m.ParseCommandLine(ptr);
+            m.program[parsed.first] = move(parsed.second);
+        }
+        if (!m.ExecuteCommand("DIM A(100):A=1:B=2:C=9:D=7:I=5:A$=\"HELLO\":B$=\"WORLD\""))
+            return false;
+        m.LinkProgram();
+
+        const char* expressionText = "(A+B*2)/SQR(C)-INT(D/3)+A(I)";
+        BasicMachine::tStatement expression;
+        const char* ptr = expressionText;
+        if (!m.TryParseExpression(expression, ptr))
+            return false;
+
+        int array = 0;
+        while (m.arrays[array].name != "A")
+            ++array;
+        byte ar = (byte)array;
+        BasicMachine::tExpressionValue index{ 5.0f };
+        BasicMachine::tValue value{ 3.0f };
+
+        printf("[\n");
+
+        Measure("ParseCommandLine", [this]()
+        {
+            const char* ptr = "30 IF A(I)>B THEN PRINT \"X\";A$+MID$(B$,2,3):GOTO 10";
+            m.ParseCommandLine(ptr);
+        });
+
+        Measure("TryParseExpression", [this, expressionText]()
+        {
+            BasicMachine::tStatement s;
+            const char* ptr = expressionText;
+            m.TryParseExpression(s, ptr);
+        });
+
+        Measure("EvaluateExpression", [this, &expression]()
+        {
+            const byte* parms = expression.data();
+            m.EvaluateExpression(parms);
+        });
+
+        Measure("ArrayGet", [this, ar, &index]()
+        {
+            m.ArrayGet(ar, index);
+        });
+
+        Measure("ArraySet", [this, ar, &index, &value]()
+        {
+            m.ArraySet(ar, index, value);
+        });
+
+        // Statement to statement, the items are skipped
+        Restore();
+        Measure("ScanForNextDataItem", [this]()
+        {
+            if (m.ScanForNextDataItem())
+                m.readPointer.itemOffset = m.readPointer.limit;
+            else
+                Restore();
+        });
+
+        Restore();
+        Measure("GetNextDataItem", [this]()
+        {
+            BasicMachine::tValue item;
+            if (!m.ScanForNextDataItem())
+                Restore();
+            else
+                m.GetNextDataItem(item);
+        });
+
+        Measure("ListStatement", [this]()
+        {
+            m.ListStatement(30, m.program[30]);
+        });
+
+        printf("\n]\n");
+        return !m.inErrorCondition;
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    BasicBenchmark benchmark(argc - 1, argv + 1);
+    return benchmark.Run() ? 0 : 1;
+}
@@ -0,0 +1,12 @@
+10 REM DATA/READ heavy: reads a table over and over
+20 T=0
+30 FOR K=1 TO 20000
+40 RESTORE
+50 FOR I=1 TO 10
+60 READ A,B$
+70 T=T+A+LEN(B$)
+80 NEXT I
+90 NEXT K
+100 PRINT T
+110 DATA 1,"ONE",2,"TWO",3,"THREE",4,"FOUR",5,"FIVE"
+120 DATA 6,"SIX",7,"SEVEN",8,"EIGHT",9,"NINE",10,"TEN"
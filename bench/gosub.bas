@@ -0,0 +1,15 @@
+10 REM GOSUB heavy: small subroutines called in a loop
+20 S=0
+30 FOR I=1 TO 300000
+40 X=I
+50 GOSUB 100
+60 GOSUB 200
+70 NEXT I
+80 PRINT S
+90 END
+100 S=S+X*2
+110 RETURN
+200 IF X/2=INT(X/2) THEN GOSUB 300
+210 RETURN
+300 S=S-1
+310 RETURN
@@ -0,0 +1,8 @@
+10 REM Numeric loops: nested FOR with arithmetic and functions
+20 S=0
+30 FOR I=1 TO 700
+40 FOR J=1 TO 700
+50 S=S+SQR(I*J)/(J+1)-INT(I/J)
+60 NEXT J
+70 NEXT I
+80 PRINT S
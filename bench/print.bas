@@ -0,0 +1,4 @@
+10 REM PRINT heavy: a long table of numbers and strings
+20 FOR I=1 TO 100000
+30 PRINT I;TAB(10);I*I;TAB(25);"ROW";I/7
+40 NEXT I
@@ -0,0 +1,14 @@
+10 REM Array sort: bubble sort of pseudo random numbers
+20 N=1000
+30 DIM A(1000)
+40 X=12345
+50 FOR I=1 TO N
+60 X=X*109+89:X=X-INT(X/1024)*1024
+70 A(I)=X
+80 NEXT I
+90 FOR I=1 TO N-1
+100 FOR J=1 TO N-I
+110 IF A(J)>A(J+1) THEN T=A(J):A(J)=A(J+1):A(J+1)=T
+120 NEXT J
+130 NEXT I
+140 PRINT A(1);A(N/2);A(N)
@@ -0,0 +1,13 @@
+10 REM String building: concatenation, MID$, LEFT$, CHR$, STR$
+20 FOR N=1 TO 2000
+30 A$=""
+40 FOR I=1 TO 100
+50 A$=A$+CHR$(65+I-INT(I/26)*26)
+60 NEXT I
+70 C=0
+80 FOR I=1 TO LEN(A$)
+90 IF MID$(A$,I,1)="A" THEN C=C+1
+100 NEXT I
+110 B$=LEFT$(A$,10)+STR$(C)+RIGHT$(A$,10)
+120 NEXT N
+130 PRINT B$
@@ -1 +1 @@
-cl /std:c++17 /EHsc basic.cpp expression.cpp functions.cpp helpers.cpp instructions.cpp variables.cpp 
+cl /std:c++17 /EHsc /DBASIC_HEAP_STATS basic.cpp expression.cpp functions.cpp helpers.cpp instructions.cpp variables.cpp bytecode.cpp jit.cpp transpiler.cpp keyboard.cpp output.cpp sampler.cpp stats.cpp tracer.cpp stringheap.cpp matrix.cpp
@@ -0,0 +1,3 @@
+@echo off
+rem Builds microbench.exe and runs the micro-benchmarks, the results are written as JSON
+cl /std:c++17 /EHsc /O2 /DBASIC_BENCH /DBASIC_HEAP_STATS /Femicrobench.exe bench\microbench.cpp basic.cpp expression.cpp functions.cpp helpers.cpp instructions.cpp variables.cpp bytecode.cpp jit.cpp transpiler.cpp keyboard.cpp output.cpp sampler.cpp stats.cpp tracer.cpp stringheap.cpp matrix.cpp && microbench.exe %*
@@ -0,0 +1,13 @@
+@echo off
+rem Runs each test program interpreted and with RUN FAST, both outputs have to match the expected one next to it
+rem (build.bat makes basic.exe)
+setlocal
+set failed=0
+for %%f in (tests\*.bas) do (
+    basic.exe %%f > "%TEMP%\basic_run.txt"
+    fc "%TEMP%\basic_run.txt" tests\%%~nf.txt > nul || (echo FAIL %%f & set failed=1)
+    basic.exe --fast %%f > "%TEMP%\basic_fast.txt"
+    fc "%TEMP%\basic_fast.txt" tests\%%~nf.txt > nul || (echo FAIL %%f --fast & set failed=1)
+)
+if %failed%==0 echo All tests passed
+exit /b %failed%
@@ -0,0 +1,14 @@
+10 REM Statements left to the interpreter see the variables RUN FAST has changed, and the other way round
+20 DEF FNA(X)=X+B
+30 A$="ONE":B=2:C$="":N=0
+40 FOR I=1 TO 3
+50 A$=A$+"!":B=B*2:C$=C$+CHR$(64+I)
+60 PRINT A$;FNA(1);
+70 READ D$,E
+80 N=N+E
+90 PRINT D$;N;C$
+100 NEXT I
+110 IF FNA(0)>10 THEN PRINT "FN SEES B";B
+120 RANDOMIZE B
+130 PRINT LEFT$(A$,3);LEN(C$)
+140 DATA "X",1,"Y",2,"Z",3
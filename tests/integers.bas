@@ -0,0 +1,12 @@
+10 REM Integer constants stay exact above 2^24, where a single precision float would round them
+20 A=16777217-16777216
+30 PRINT A
+40 B=16777216+1-16777216
+50 PRINT B
+60 C=-(16777217)+16777216
+70 PRINT C
+80 IF 16777217>16777216 THEN PRINT "GREATER"
+90 D=(16777217=16777216)
+100 PRINT D
+110 E=4000*5000-19999999
+120 PRINT E
@@ -0,0 +1,5 @@
+10 REM MAT with a dimension past the array limit is an error
+20 MAT A=IDN(2,2)
+30 MAT PRINT A
+40 MAT A=CON(40000)
+50 PRINT "NOT REACHED"
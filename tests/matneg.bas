@@ -0,0 +1,4 @@
+10 REM MAT with a negative dimension is an error
+20 MAT A=CON(2)
+30 MAT A=ZER(-1)
+40 PRINT "NOT REACHED"
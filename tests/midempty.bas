@@ -0,0 +1,6 @@
+10 REM MID$ from an empty string is an error in both engines
+20 A$="HELLO"
+30 PRINT MID$(A$,2);MID$(A$,2,3);MID$(A$,9)
+40 A$=""
+50 B$=MID$(A$,1)
+60 PRINT "NOT REACHED"
@@ -0,0 +1,5 @@
+10 REM MID$ starting before the first character is an error in both engines
+20 A$="HELLO"
+30 PRINT MID$(A$,1,2)
+40 B$=MID$(A$,0)
+50 PRINT "NOT REACHED"
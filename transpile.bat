@@ -0,0 +1,3 @@
+@echo off
+rem Builds program.exe from program.bas through C++: transpile program
+basic --emit-cpp %1.bas %1.cpp && cl /std:c++17 /EHsc /O2 /DBASIC_TRANSPILED /Fe%1.exe %1.cpp basic.cpp expression.cpp functions.cpp helpers.cpp instructions.cpp variables.cpp bytecode.cpp jit.cpp transpiler.cpp keyboard.cpp output.cpp sampler.cpp stats.cpp tracer.cpp stringheap.cpp matrix.cpp